@@ -6,6 +6,10 @@
 
 #include "fake_notifications_server.h"
 
+#include <QDBusArgument>
+#include <QDBusUnixFileDescriptor>
+#include <QFile>
+
 NotificationsServer::NotificationsServer(QObject *parent)
 {
     Q_UNUSED(parent);
@@ -21,6 +25,11 @@ uint NotificationsServer::Notify(const QString &app_name,
                                  const QVariantMap &hints,
                                  int timeout)
 {
+    if (failNotify) {
+        sendErrorReply(QDBusError::Failed, QStringLiteral("Notifications are failing"));
+        return 0;
+    }
+
     NotificationItem i;
     i.app_name = app_name;
     i.replaces_id = replaces_id;
@@ -32,6 +41,27 @@ uint NotificationsServer::Notify(const QString &app_name,
     i.timeout = timeout;
     i.id = counter;
 
+    const QVariant imageFd = hints.value(QStringLiteral("x-kde-image-fd"));
+    if (imageFd.canConvert<QDBusArgument>()) {
+        int width, height, rowStride, bitsPerSample, channels;
+        bool hasAlpha;
+        QDBusUnixFileDescriptor fd;
+
+        const QDBusArgument argument = imageFd.value<QDBusArgument>();
+        argument.beginStructure();
+        argument >> width >> height >> rowStride >> hasAlpha >> bitsPerSample >> channels >> fd;
+        argument.endStructure();
+
+        // the file offset is shared with the client, so don't read() but map it
+        QFile file;
+        if (file.open(fd.fileDescriptor(), QIODevice::ReadOnly)) {
+            if (const uchar *data = file.map(0, file.size())) {
+                i.imageFdData = QByteArray(reinterpret_cast<const char *>(data), file.size());
+                file.unmap(const_cast<uchar *>(data));
+            }
+        }
+    }
+
     notifications.append(i);
 
     Q_EMIT newNotification();
@@ -55,7 +85,12 @@ void NotificationsServer::CloseNotification(uint id)
 
 QStringList NotificationsServer::GetCapabilities()
 {
-    return QStringList{QStringLiteral("body-markup"), QStringLiteral("body"), QStringLiteral("actions")};
+    ++capabilitiesQueries;
+    QStringList capabilities{QStringLiteral("body-markup"), QStringLiteral("body"), QStringLiteral("actions")};
+    if (supportsImageFd) {
+        capabilities << QStringLiteral("x-kde-image-fd");
+    }
+    return capabilities;
 }
 
 QString NotificationsServer::GetServerInformation(QString &vendor, QString &version, QString &specVersion)
@@ -7,6 +7,7 @@
 #ifndef FAKE_NOTIFICATIONS_SERVER_H
 #define FAKE_NOTIFICATIONS_SERVER_H
 
+#include <QDBusContext>
 #include <QHash>
 #include <QObject>
 #include <QVariantMap>
@@ -23,9 +24,11 @@ public:
     QVariantMap hints;
     int timeout;
     uint id;
+    // the pixels passed in the x-kde-image-fd hint
+    QByteArray imageFdData;
 };
 
-class NotificationsServer : public QObject
+class NotificationsServer : public QObject, protected QDBusContext
 {
     Q_OBJECT
     Q_CLASSINFO("D-Bus Interface", "org.freedesktop.Notifications")
@@ -35,6 +38,12 @@ public:
 
     uint counter;
     QList<NotificationItem> notifications;
+    // whether to advertise the x-kde-image-fd capability
+    bool supportsImageFd = false;
+    // how often GetCapabilities was called
+    int capabilitiesQueries = 0;
+    // whether Notify replies with an error
+    bool failNotify = false;
 
 public Q_SLOTS:
     uint Notify(const QString &app_name,
@@ -5,11 +5,26 @@
 */
 
 #include <QDBusConnection>
+#include <QImage>
 #include <QObject>
+#include <QPointer>
+#include <QScopeGuard>
+#include <QSignalSpy>
 #include <QStandardPaths>
-#include <qtest.h>
+#include <QTemporaryDir>
+#include <QTest>
+#include <QTextDocumentFragment>
 
+#include <algorithm>
+#include <cstdlib>
+
+#include "../src/imageconverter.h"
 #include "../src/knotification.h"
+#include "../src/knotificationmanager_p.h"
+#include "../src/knotifyconfig.h"
+#include "../src/notifybypopup.h"
+#include "../src/pixelconversion.h"
+#include "../src/richtext.h"
 #include "fake_notifications_server.h"
 #include "qtest_dbus.h"
 
@@ -20,6 +35,8 @@ class KNotificationTest : public QObject
 private Q_SLOTS:
     void initTestCase();
     void cleanupTestCase();
+    void cleanup();
+
     void gettersTest();
     void idTest();
     void immediateCloseTest();
@@ -27,49 +44,96 @@ private Q_SLOTS:
     void serverCloseTest();
     void serverActionsTest();
     void noActionsTest();
+    void rateLimitTest();
+    void serverCapabilitiesTest();
+    void pathEntryTest();
+    void immutableEntryTest();
+    void cacheStatisticsTest();
+    void aggregatedBurstTest();
+    void aggregateClosedTest();
+    void aggregateFailureTest();
+    void aggregateHandOverTest();
+    void taggedReplaceTest();
+    void taggedReplaceFailureTest();
+    void taggedBurstTest();
+    void releasedImageUpdateTest();
+    void retainedImageClosedTest();
+    void imageOrderTest();
+    void imageTransportTest_data();
+    void imageTransportTest();
+    void pixelConversionTest_data();
+    void pixelConversionTest();
+    void toPlainTextTest_data();
+    void toPlainTextTest();
+    void normalizedMarkupTest();
+    void elidedTest();
 
 private:
-    NotificationsServer *m_server;
+    // Waits until the server got a notification for which matches returns true
+    template<typename Predicate>
+    bool waitForNotification(Predicate matches);
+    void closeAllOnServer();
+
+    NotificationsServer *m_server = nullptr;
 };
 
 void KNotificationTest::initTestCase()
 {
     QStandardPaths::setTestModeEnabled(true);
     const QString dataDir = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation);
-    qDebug() << dataDir;
 
     QDir dir;
-    bool pathOk = dir.mkpath(dataDir + QStringLiteral("/knotifications6/"));
+    QVERIFY(dir.mkpath(dataDir + QStringLiteral("/knotifications6/")));
 
-    QVERIFY(pathOk);
+    const QString notifyRc = dataDir + QStringLiteral("/knotifications6/qttest.notifyrc");
+    QFile::remove(notifyRc);
+    QVERIFY(QFile::copy(QFINDTESTDATA(QStringLiteral("knotifications6/qttest.notifyrc")), notifyRc));
 
-    QFile testFile(QFINDTESTDATA(QStringLiteral("knotifications6/qttest.notifyrc")));
-    bool fileOk = testFile.copy(dataDir + QStringLiteral("/knotifications6/qttest.notifyrc"));
-
-    QVERIFY(fileOk);
+    // compiled notifyrc files and stored images from earlier runs
+    const QString cacheDir = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation);
+    QVERIFY(QDir(cacheDir + QStringLiteral("/knotifications6")).removeRecursively());
 
     m_server = new NotificationsServer(this);
 
-    bool rs = QDBusConnection::sessionBus().registerService(QStringLiteral("org.freedesktop.Notifications"));
-    bool ro = QDBusConnection::sessionBus().registerObject(QStringLiteral("/org/freedesktop/Notifications"), m_server, QDBusConnection::ExportAllContents);
-
-    QVERIFY(rs);
-    QVERIFY(ro);
+    QVERIFY(QDBusConnection::sessionBus().registerService(QStringLiteral("org.freedesktop.Notifications")));
+    QVERIFY(QDBusConnection::sessionBus().registerObject(QStringLiteral("/org/freedesktop/Notifications"), m_server, QDBusConnection::ExportAllContents));
 }
 
 void KNotificationTest::cleanupTestCase()
 {
-    // Cleanup
     const QString dataDir = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation);
-    QFile testFile(dataDir + QStringLiteral("/knotifications6/qttest.notifyrc"));
-    bool fileRemoveOk = testFile.remove();
+    QDir dir(dataDir + QStringLiteral("/knotifications6"));
+    QVERIFY(dir.removeRecursively());
 
-    QVERIFY(fileRemoveOk);
+    const QString cacheDir = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation);
+    QVERIFY(QDir(cacheDir + QStringLiteral("/knotifications6")).removeRecursively());
+}
 
-    QDir dir(dataDir + QStringLiteral("/knotifications6"));
-    bool dirRemoveOk = dir.removeRecursively();
+void KNotificationTest::cleanup()
+{
+    closeAllOnServer();
+}
 
-    QVERIFY(dirRemoveOk);
+template<typename Predicate>
+bool KNotificationTest::waitForNotification(Predicate matches)
+{
+    const bool ok = QTest::qWaitFor([this, &matches] {
+        return std::any_of(m_server->notifications.cbegin(), m_server->notifications.cend(), matches);
+    });
+    // let the replies travel back to the client
+    QTest::qWait(50);
+    return ok;
+}
+
+void KNotificationTest::closeAllOnServer()
+{
+    const auto notifications = m_server->notifications;
+    for (const NotificationItem &item : notifications) {
+        // reason 2 == "dismissed by the user", which also closes the KNotification
+        Q_EMIT m_server->NotificationClosed(item.id, 2);
+    }
+    m_server->notifications.clear();
+    QTest::qWait(50);
 }
 
 void KNotificationTest::gettersTest()
@@ -80,7 +144,7 @@ void KNotificationTest::gettersTest()
     KNotification *n = new KNotification(testEvent);
     n->setText(QStringLiteral("Test"));
 
-    QCOMPARE(n->id(), -1);
+    QVERIFY(n->id() > 0);
     QCOMPARE(n->eventId(), testEvent);
     QCOMPARE(n->text(), testText);
     QCOMPARE(n->title(), QString());
@@ -94,8 +158,8 @@ void KNotificationTest::gettersTest()
     n->setComponentName(QStringLiteral("testtest"));
     QCOMPARE(n->appName(), QStringLiteral("testtest"));
 
-    QSignalSpy nClosedSpy(n, SIGNAL(closed()));
-    QSignalSpy nDestroyedSpy(n, SIGNAL(destroyed(QObject *)));
+    QSignalSpy nClosedSpy(n, &KNotification::closed);
+    QSignalSpy nDestroyedSpy(n, &QObject::destroyed);
 
     // Calling ref and deref simulates a Notification plugin
     // starting and ending an action, after the action has
@@ -113,30 +177,26 @@ void KNotificationTest::gettersTest()
 void KNotificationTest::idTest()
 {
     KNotification n(QStringLiteral("testEvent"));
+    n.setAutoDelete(false);
+    KNotification other(QStringLiteral("testEvent"));
 
-    QCOMPARE(n.id(), -1);
+    // every notification gets its own id when it is created
+    const int id = n.id();
+    QVERIFY(id > 0);
+    QVERIFY(other.id() != id);
 
+    // which it keeps while it is shown
     n.sendEvent();
+    QCOMPARE(n.id(), id);
 
-    // The first id is 0; the previous test did not
-    // call sendEvent() and therefore should not have
-    // increased the id counter, which starts at 0
-    QCOMPARE(n.id(), 0);
-
-    // TODO
-    // At this point there is no clean/sane way
-    // to test the other id() changes throughout
-    // the life of KNotification, ideally there
-    // would be a signal sending out the changed
-    // id values that would be caught by a signal spy
-    // and then checked
+    n.close();
 }
 
 void KNotificationTest::immediateCloseTest()
 {
     KNotification *n = new KNotification(QStringLiteral("testEvent"));
 
-    QSignalSpy nClosedSpy(n, SIGNAL(closed()));
+    QSignalSpy nClosedSpy(n, &KNotification::closed);
 
     n->close();
 
@@ -149,29 +209,28 @@ void KNotificationTest::serverCallTest()
 {
     const QString testText = QStringLiteral("Test");
 
-    QSignalSpy serverNewSpy(m_server, SIGNAL(newNotification()));
-    QSignalSpy serverClosedSpy(m_server, SIGNAL(NotificationClosed(uint, uint)));
+    QSignalSpy serverNewSpy(m_server, &NotificationsServer::newNotification);
+    QSignalSpy serverClosedSpy(m_server, &NotificationsServer::NotificationClosed);
 
     KNotification n(QStringLiteral("testEvent"));
+    n.setAutoDelete(false);
     n.setText(testText);
     n.setFlags(KNotification::Persistent);
 
     n.sendEvent();
 
-    serverNewSpy.wait(500);
+    QVERIFY(serverNewSpy.wait(500));
 
     QCOMPARE(m_server->notifications.last().body, testText);
     // timeout 0 is persistent notification
     QCOMPARE(m_server->notifications.last().timeout, 0);
 
-    QCOMPARE(n.id(), 1);
-
     // Give the dbus communication some time to finish
     QTest::qWait(300);
 
     n.close();
 
-    serverClosedSpy.wait(500);
+    QVERIFY(serverClosedSpy.wait(500));
     QCOMPARE(serverClosedSpy.size(), 1);
     QCOMPARE(m_server->notifications.size(), 0);
 }
@@ -179,18 +238,19 @@ void KNotificationTest::serverCallTest()
 void KNotificationTest::serverCloseTest()
 {
     KNotification n(QStringLiteral("testEvent"));
+    n.setAutoDelete(false);
     n.setText(QStringLiteral("Test"));
     n.setFlags(KNotification::Persistent);
     n.sendEvent();
 
-    QSignalSpy nClosedSpy(&n, SIGNAL(closed()));
+    QSignalSpy nClosedSpy(&n, &KNotification::closed);
 
     // Give the dbus some time
     QTest::qWait(300);
 
     uint id = m_server->notifications.last().id;
 
-    m_server->NotificationClosed(id, 2);
+    Q_EMIT m_server->NotificationClosed(id, 2);
 
     nClosedSpy.wait(100);
 
@@ -200,32 +260,32 @@ void KNotificationTest::serverCloseTest()
 void KNotificationTest::serverActionsTest()
 {
     KNotification n(QStringLiteral("testEvent"));
+    n.setAutoDelete(false);
     n.setText(QStringLiteral("Test"));
-    n.setActions(QStringList{QStringLiteral("a1"), QStringLiteral("a2")});
+    KNotificationAction *a1 = n.addAction(QStringLiteral("a1"));
+    KNotificationAction *a2 = n.addAction(QStringLiteral("a2"));
     n.sendEvent();
 
-    QSignalSpy serverClosedSpy(m_server, SIGNAL(NotificationClosed(uint, uint)));
-    QSignalSpy nClosedSpy(&n, SIGNAL(closed()));
-    QSignalSpy nActivatedSpy(&n, SIGNAL(activated(uint)));
-    QSignalSpy nActivated2Spy(&n, SIGNAL(action1Activated()));
+    QSignalSpy serverClosedSpy(m_server, &NotificationsServer::NotificationClosed);
+    QSignalSpy nClosedSpy(&n, &KNotification::closed);
+    QSignalSpy a1ActivatedSpy(a1, &KNotificationAction::activated);
+    QSignalSpy a2ActivatedSpy(a2, &KNotificationAction::activated);
 
     QTest::qWait(300);
 
     uint id = m_server->notifications.last().id;
 
-    Q_EMIT m_server->ActionInvoked(id, QString::number(1));
+    Q_EMIT m_server->ActionInvoked(id, a1->id());
 
-    nActivatedSpy.wait(300);
+    a1ActivatedSpy.wait(300);
     // After the notification action was invoked,
     // the notification should request closing
     serverClosedSpy.wait(300);
     nClosedSpy.wait(300);
 
     QCOMPARE(serverClosedSpy.size(), 1);
-    QCOMPARE(nActivatedSpy.size(), 1);
-    QCOMPARE(nActivated2Spy.size(), 1);
-    // The argument must be 1, as was passed to the ActionInvoked
-    QCOMPARE(nActivatedSpy.at(0).at(0).toInt(), 1);
+    QCOMPARE(a1ActivatedSpy.size(), 1);
+    QCOMPARE(a2ActivatedSpy.size(), 0);
     QCOMPARE(nClosedSpy.size(), 1);
 }
 
@@ -233,13 +293,690 @@ void KNotificationTest::noActionsTest()
 {
     // event doesn't exist in config, meaning it has no actions
     QPointer<KNotification> n(new KNotification(QStringLiteral("noActionsEvent")));
-    QSignalSpy nClosedSpy(n, SIGNAL(closed()));
+    QSignalSpy nClosedSpy(n, &KNotification::closed);
     n->sendEvent();
 
     nClosedSpy.wait(100);
     QCOMPARE(nClosedSpy.size(), 1);
-    QVERIFY(n.isNull());
+    QTRY_VERIFY(n.isNull());
+}
+
+void KNotificationTest::rateLimitTest()
+{
+    auto writeFile = [](const QString &fileName, const QByteArray &contents) {
+        QFile file(fileName);
+        return file.open(QIODevice::WriteOnly) && file.write(contents) == contents.size();
+    };
+
+    const QString dataDir = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + QStringLiteral("/knotifications6/");
+    QVERIFY(writeFile(dataDir + QStringLiteral("ratelimittest.notifyrc"),
+                      "[Global]\nRateLimitPolicy=Defer\n\n[Event/limited]\nAction=Popup\nRateLimit=1\nBurst=2\n\n[Event/unlimited]\nAction=Popup\n"));
+    QVERIFY(writeFile(dataDir + QStringLiteral("ratelimitapptest.notifyrc"),
+                      "[Global]\nRateLimit=1\nBurst=2\nRateLimitPolicy=Defer\n\n[Event/a]\nAction=Popup\n\n[Event/b]\nAction=Popup\n"));
+
+    // the buckets go by this rather than the time that passes, which would make the test depend on how fast it runs
+    qint64 now = 0;
+    KNotificationManager::self()->setRateLimitClock([&now] {
+        return now;
+    });
+
+    QList<QPointer<KNotification>> notifications;
+    auto restore = qScopeGuard([&notifications, &dataDir] {
+        // none of them may show up in later tests
+        for (const QPointer<KNotification> &n : std::as_const(notifications)) {
+            if (n) {
+                n->close();
+            }
+        }
+        KNotificationManager::self()->setRateLimitClock({});
+        QFile::remove(dataDir + QStringLiteral("ratelimittest.notifyrc"));
+        QFile::remove(dataDir + QStringLiteral("ratelimitapptest.notifyrc"));
+    });
+
+    auto send = [&notifications](const QString &componentName, const QString &eventId, const QString &text) {
+        KNotification *n = new KNotification(eventId);
+        n->setComponentName(componentName);
+        n->setText(text);
+        notifications.append(n);
+        n->sendEvent();
+    };
+    auto sent = [this] {
+        QStringList bodies;
+        for (const NotificationItem &item : std::as_const(m_server->notifications)) {
+            bodies.append(item.body);
+        }
+        return bodies;
+    };
+    auto sendDeferred = [] {
+        QMetaObject::invokeMethod(KNotificationManager::self(), "sendDeferredNotifications");
+    };
+
+    // only the notifications of the limited event wait, the others of the application don't
+    for (int i = 0; i < 4; ++i) {
+        send(QStringLiteral("ratelimittest"), QStringLiteral("limited"), QStringLiteral("L%1").arg(i));
+    }
+    send(QStringLiteral("ratelimittest"), QStringLiteral("unlimited"), QStringLiteral("U"));
+    QVERIFY(waitForNotification([](const NotificationItem &item) {
+        return item.body == QLatin1String("U");
+    }));
+    QCOMPARE(sent(), QStringList({QStringLiteral("L0"), QStringLiteral("L1"), QStringLiteral("U")}));
+
+    // one more a second, in the order they came in
+    now += 1000;
+    sendDeferred();
+    QVERIFY(waitForNotification([](const NotificationItem &item) {
+        return item.body == QLatin1String("L2");
+    }));
+    QCOMPARE(sent(), QStringList({QStringLiteral("L0"), QStringLiteral("L1"), QStringLiteral("U"), QStringLiteral("L2")}));
+
+    closeAllOnServer();
+
+    // the limit of the whole application holds back all of its events
+    send(QStringLiteral("ratelimitapptest"), QStringLiteral("a"), QStringLiteral("A0"));
+    send(QStringLiteral("ratelimitapptest"), QStringLiteral("b"), QStringLiteral("B0"));
+    send(QStringLiteral("ratelimitapptest"), QStringLiteral("a"), QStringLiteral("A1"));
+    send(QStringLiteral("ratelimitapptest"), QStringLiteral("b"), QStringLiteral("B1"));
+    QVERIFY(waitForNotification([](const NotificationItem &item) {
+        return item.body == QLatin1String("B0");
+    }));
+    QCOMPARE(sent(), QStringList({QStringLiteral("A0"), QStringLiteral("B0")}));
+
+    // there is a token again, but the ones held back get it first
+    now += 1000;
+    send(QStringLiteral("ratelimitapptest"), QStringLiteral("b"), QStringLiteral("B2"));
+    sendDeferred();
+    QVERIFY(waitForNotification([](const NotificationItem &item) {
+        return item.body == QLatin1String("A1");
+    }));
+    QCOMPARE(sent(), QStringList({QStringLiteral("A0"), QStringLiteral("B0"), QStringLiteral("A1")}));
+
+    now += 2000;
+    sendDeferred();
+    QVERIFY(waitForNotification([](const NotificationItem &item) {
+        return item.body == QLatin1String("B2");
+    }));
+    QCOMPARE(sent(), QStringList({QStringLiteral("A0"), QStringLiteral("B0"), QStringLiteral("A1"), QStringLiteral("B1"), QStringLiteral("B2")}));
+}
+
+void KNotificationTest::serverCapabilitiesTest()
+{
+    const QString fileName = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + QStringLiteral("/knotifications6/notificationserver");
+    QFile::remove(fileName);
+    const int queries = m_server->capabilitiesQueries;
+
+    // nothing known about the server yet, the capabilities are asked for right away
+    NotifyByPopup popup;
+    QVERIFY(QTest::qWaitFor([&popup, &fileName] {
+        return !popup.m_dbusServiceCapCacheDirty && QFile::exists(fileName);
+    }));
+    QTest::qWait(50);
+
+    // and stored once the server information is there as well, rather than asked for again
+    QCOMPARE(m_server->capabilitiesQueries, queries + 1);
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QCOMPARE(file.readLine().trimmed(), QByteArrayLiteral("TestServer"));
+
+    // the next one goes by what was stored, without markup until the server turns out to be the same
+    NotifyByPopup other;
+    QVERIFY(!other.m_dbusServiceCapCacheDirty);
+    QVERIFY(other.m_popupServerCapabilities.contains(QStringLiteral("actions")));
+    QVERIFY(!other.m_popupServerCapabilities.contains(QStringLiteral("body-markup")));
+    QVERIFY(QTest::qWaitFor([&other] {
+        return other.m_popupServerCapabilities.contains(QStringLiteral("body-markup"));
+    }));
+    QTest::qWait(50);
+    QCOMPARE(m_server->capabilitiesQueries, queries + 1);
+}
+
+void KNotificationTest::pathEntryTest()
+{
+    const KNotifyConfig config(QStringLiteral("qttest"), QStringLiteral("pathEvent"));
+
+    // expanded like KConfigGroup::readPathEntry() does, even without [$e]
+    QCOMPARE(config.readPathEntry(QStringLiteral("Sound")), qEnvironmentVariable("HOME") + QStringLiteral("/sounds/event.ogg"));
+    QCOMPARE(config.readEntry(QStringLiteral("Sound")), QStringLiteral("$HOME/sounds/event.ogg"));
+    QCOMPARE(config.readPathEntry(QStringLiteral("Icon")), QDir::homePath() + QStringLiteral("/icons/event.png"));
+}
+
+void KNotificationTest::immutableEntryTest()
+{
+    // a less important location than the writable one
+    QTemporaryDir systemDir;
+    QVERIFY(systemDir.isValid());
+    QVERIFY(QDir(systemDir.path()).mkpath(QStringLiteral("knotifications6")));
+    const QByteArray oldDataDirs = qgetenv("XDG_DATA_DIRS");
+    qputenv("XDG_DATA_DIRS", QFile::encodeName(systemDir.path()));
+    auto restoreDataDirs = qScopeGuard([&oldDataDirs] {
+        qputenv("XDG_DATA_DIRS", oldDataDirs);
+    });
+
+    auto writeFile = [](const QString &fileName, const QByteArray &contents) {
+        QFile file(fileName);
+        return file.open(QIODevice::WriteOnly) && file.write(contents) == contents.size();
+    };
+
+    const QString relativePath = QStringLiteral("knotifications6/immutabletest.notifyrc");
+    const QString userFile = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + QLatin1Char('/') + relativePath;
+    auto removeUserFile = qScopeGuard([&userFile] {
+        QFile::remove(userFile);
+    });
+
+    QVERIFY(writeFile(systemDir.filePath(relativePath), "[Event/locked][$i]\nAction=Popup\n\n[Event/partly]\nAction[$i]=Popup\nSound=a.ogg\n"));
+    QVERIFY(writeFile(userFile, "[Event/locked]\nAction=Sound\n\n[Event/partly]\nAction=Sound\nSound=b.ogg\n"));
+
+    const KNotifyConfig locked(QStringLiteral("immutabletest"), QStringLiteral("locked"));
+    QCOMPARE(locked.readEntry(QStringLiteral("Action")), QStringLiteral("Popup"));
+    const KNotifyConfig partly(QStringLiteral("immutabletest"), QStringLiteral("partly"));
+    QCOMPARE(partly.readEntry(QStringLiteral("Action")), QStringLiteral("Popup"));
+    QCOMPARE(partly.readEntry(QStringLiteral("Sound")), QStringLiteral("b.ogg"));
+}
+
+void KNotificationTest::cacheStatisticsTest()
+{
+    // a daemon notifying on behalf of lots of applications must not keep evicting their config files
+    constexpr int count = 50;
+
+    auto readAll = [] {
+        for (int i = 0; i < count; ++i) {
+            const KNotifyConfig config(QStringLiteral("statisticstest") + QString::number(i), QStringLiteral("testEvent"));
+            const QString value = config.readEntry(QStringLiteral("Action"));
+            Q_UNUSED(value);
+        }
+    };
+
+    KNotifyConfig::reparseConfiguration();
+    KNotifyConfig::resetCacheStatistics();
+
+    // the events file and the user configuration of each application
+    readAll();
+    KNotifyConfig::CacheStatistics statistics = KNotifyConfig::cacheStatistics();
+    QCOMPARE(statistics.misses, qint64(2 * count));
+    QCOMPARE(statistics.hits, qint64(0));
+    QCOMPARE(statistics.evictions, qint64(0));
+    QVERIFY(statistics.count >= 2 * count);
+
+    readAll();
+    statistics = KNotifyConfig::cacheStatistics();
+    QCOMPARE(statistics.misses, qint64(2 * count));
+    QCOMPARE(statistics.hits, qint64(2 * count));
+    QCOMPARE(statistics.evictions, qint64(0));
+}
+
+void KNotificationTest::aggregatedBurstTest()
+{
+    constexpr int count = 20;
+
+    QObject parent;
+    for (int i = 0; i < count; ++i) {
+        KNotification *n = new KNotification(QStringLiteral("burstEvent"), KNotification::Persistent, &parent);
+        n->setTitle(QString::number(i));
+        n->sendEvent();
+    }
+
+    // the newest titles first
+    QVERIFY(waitForNotification([](const NotificationItem &item) {
+        return item.body.startsWith(QLatin1String("19\n18\n"));
+    }));
+
+    const qsizetype popups = std::count_if(m_server->notifications.cbegin(), m_server->notifications.cend(), [](const NotificationItem &item) {
+        return item.replaces_id == 0;
+    });
+    QCOMPARE(popups, 1);
+}
+
+void KNotificationTest::aggregateClosedTest()
+{
+    constexpr int count = 5;
+
+    QObject parent;
+    int closed = 0;
+    for (int i = 0; i < count; ++i) {
+        KNotification *n = new KNotification(QStringLiteral("burstEvent"), KNotification::Persistent, &parent);
+        n->setTitle(QString::number(i));
+        connect(n, &KNotification::closed, this, [&closed] {
+            ++closed;
+        });
+        n->sendEvent();
+    }
+
+    QVERIFY(waitForNotification([](const NotificationItem &item) {
+        return item.body.startsWith(QLatin1String("4\n3\n"));
+    }));
+
+    // the user dismissing the notification shown for the burst dismisses all of it
+    Q_EMIT m_server->NotificationClosed(m_server->notifications.constFirst().id, 2);
+    QTRY_COMPARE(closed, count);
+}
+
+void KNotificationTest::aggregateFailureTest()
+{
+    constexpr int count = 3;
+
+    m_server->failNotify = true;
+
+    QObject parent;
+    int closed = 0;
+    for (int i = 0; i < count; ++i) {
+        KNotification *n = new KNotification(QStringLiteral("burstEvent"), KNotification::Persistent, &parent);
+        n->setTitle(QString::number(i));
+        connect(n, &KNotification::closed, this, [&closed] {
+            ++closed;
+        });
+        n->sendEvent();
+    }
+
+    // none of the burst can be shown, so all of it is done with
+    QTRY_COMPARE(closed, count);
+    m_server->failNotify = false;
+
+    // and the next one is not held back by what is left of it
+    KNotification *next = new KNotification(QStringLiteral("burstEvent"), KNotification::Persistent, &parent);
+    next->setTitle(QStringLiteral("Next"));
+    next->sendEvent();
+    QVERIFY(waitForNotification([](const NotificationItem &item) {
+        return item.replaces_id == 0 && item.summary == QLatin1String("Next");
+    }));
+}
+
+void KNotificationTest::aggregateHandOverTest()
+{
+    NotifyByPopup popup;
+    const KNotifyConfig config(QCoreApplication::applicationName(), QStringLiteral("burstEvent"));
+
+    KNotification first(QStringLiteral("burstEvent"), KNotification::Persistent);
+    first.setAutoDelete(false);
+    first.setTitle(QStringLiteral("First"));
+    popup.notify(&first, config);
+
+    QVERIFY(waitForNotification([](const NotificationItem &item) {
+        return item.summary == QLatin1String("First");
+    }));
+
+    KNotification second(QStringLiteral("burstEvent"), KNotification::Persistent);
+    second.setAutoDelete(false);
+    second.setTitle(QStringLiteral("Second"));
+    popup.notify(&second, config);
+
+    QVERIFY(waitForNotification([](const NotificationItem &item) {
+        return item.body.startsWith(QLatin1String("Second\nFirst"));
+    }));
+
+    // the notification on the server belongs to the newest one only
+    const uint id = m_server->notifications.constFirst().id;
+    QCOMPARE(popup.m_notifications.value(id).data(), &second);
+    QCOMPARE(popup.m_notificationIds.value(&second), id);
+    QVERIFY(!popup.m_notificationIds.contains(&first));
+}
+
+void KNotificationTest::taggedReplaceTest()
+{
+    KNotification *first = new KNotification(QStringLiteral("testEvent"), KNotification::Persistent);
+    first->setTag(QStringLiteral("download"));
+    first->setText(QStringLiteral("1%"));
+    first->sendEvent();
+
+    QVERIFY(waitForNotification([](const NotificationItem &item) {
+        return item.body == QLatin1String("1%");
+    }));
+    const uint id = m_server->notifications.constLast().id;
+
+    QSignalSpy firstClosedSpy(first, &KNotification::closed);
+
+    KNotification *second = new KNotification(QStringLiteral("testEvent"), KNotification::Persistent);
+    second->setTag(QStringLiteral("download"));
+    second->setText(QStringLiteral("2%"));
+    second->sendEvent();
+
+    // shown in place of the first one, which is done with
+    QVERIFY(waitForNotification([](const NotificationItem &item) {
+        return item.body == QLatin1String("2%");
+    }));
+    QCOMPARE(m_server->notifications.constLast().replaces_id, id);
+    QTRY_COMPARE(firstClosedSpy.size(), 1);
+
+    // and activating it activates the second one
+    KNotificationAction *action = second->addAction(QStringLiteral("Open"));
+    QSignalSpy activatedSpy(action, &KNotificationAction::activated);
+    Q_EMIT m_server->ActionInvoked(id, action->id());
+    QVERIFY(activatedSpy.wait(500));
+}
+
+void KNotificationTest::taggedReplaceFailureTest()
+{
+    NotifyByPopup popup;
+    const KNotifyConfig config(QCoreApplication::applicationName(), QStringLiteral("testEvent"));
+    QSignalSpy finishedSpy(&popup, &KNotificationPlugin::finished);
+
+    KNotification first(QStringLiteral("testEvent"), KNotification::Persistent);
+    first.setAutoDelete(false);
+    first.setTag(QStringLiteral("upload"));
+    first.setText(QStringLiteral("1%"));
+    popup.notify(&first, config);
+
+    QVERIFY(waitForNotification([](const NotificationItem &item) {
+        return item.body == QLatin1String("1%");
+    }));
+    const uint id = m_server->notifications.constLast().id;
+
+    KNotification second(QStringLiteral("testEvent"), KNotification::Persistent);
+    second.setAutoDelete(false);
+    second.setTag(QStringLiteral("upload"));
+    second.setText(QStringLiteral("2%"));
+    popup.replace(&first, &second, config);
+
+    QVERIFY(waitForNotification([](const NotificationItem &item) {
+        return item.body == QLatin1String("2%");
+    }));
+    QVERIFY(!popup.m_notificationIds.contains(&first));
+    QCOMPARE(popup.m_notificationIds.value(&second), id);
+    QCOMPARE(finishedSpy.size(), 1);
+
+    // the server refusing to replace it leaves the third one with nothing to show
+    m_server->failNotify = true;
+    KNotification third(QStringLiteral("testEvent"), KNotification::Persistent);
+    third.setAutoDelete(false);
+    third.setTag(QStringLiteral("upload"));
+    third.setText(QStringLiteral("3%"));
+    popup.replace(&second, &third, config);
+
+    QTRY_COMPARE(finishedSpy.size(), 3);
+    m_server->failNotify = false;
+    QCOMPARE(finishedSpy.at(2).at(0).value<KNotification *>(), &third);
+    QVERIFY(!popup.m_notificationIds.contains(&third));
+    QVERIFY(!popup.m_notifications.contains(id));
+}
+
+void KNotificationTest::taggedBurstTest()
+{
+    constexpr int count = 20;
+
+    // outlives the notifications, the last one is closed when they are deleted
+    int closed = 0;
+    QObject parent;
+    for (int i = 0; i < count; ++i) {
+        KNotification *n = new KNotification(QStringLiteral("testEvent"), KNotification::Persistent, &parent);
+        n->setTag(QStringLiteral("progress"));
+        n->setText(QString::number(i));
+        connect(n, &KNotification::closed, this, [&closed] {
+            ++closed;
+        });
+        n->sendEvent();
+    }
+
+    QVERIFY(waitForNotification([](const NotificationItem &item) {
+        return item.body == QLatin1String("19");
+    }));
+
+    // the replaced ones are done with, the newest one is still shown
+    QTRY_COMPARE(closed, count - 1);
+
+    const qsizetype popups = std::count_if(m_server->notifications.cbegin(), m_server->notifications.cend(), [](const NotificationItem &item) {
+        return item.replaces_id == 0;
+    });
+    QCOMPARE(popups, 1);
+}
+
+void KNotificationTest::releasedImageUpdateTest()
+{
+    QImage image(64, 64, QImage::Format_ARGB32_Premultiplied);
+    image.fill(QColor(0x40, 0x20, 0x80, 0xff));
+
+    KNotification *n = new KNotification(QStringLiteral("testEvent"), KNotification::Persistent | KNotification::ReleaseImageAfterDelivery);
+    n->setText(QStringLiteral("Hello World"));
+    n->setImage(image);
+    image = QImage();
+    n->sendEvent();
+
+    QVERIFY(waitForNotification([](const NotificationItem &item) {
+        return item.body == QLatin1String("Hello World");
+    }));
+    QVERIFY(n->image().isNull());
+
+    n->setText(QStringLiteral("Hello again"));
+    n->update();
+
+    // updates still show the image without the pixels being around
+    QVERIFY(waitForNotification([](const NotificationItem &item) {
+        return item.body == QLatin1String("Hello again");
+    }));
+    const NotificationItem &item = m_server->notifications.constLast();
+    QCOMPARE(item.replaces_id, m_server->notifications.constFirst().id);
+    QVERIFY(item.hints.contains(QStringLiteral("image_data")) || item.hints.contains(QStringLiteral("image-path")));
+}
+
+void KNotificationTest::retainedImageClosedTest()
+{
+    NotifyByPopup popup;
+    popup.queryPopupServerCapabilities();
+    QVERIFY(QTest::qWaitFor([&popup] {
+        return !popup.m_dbusServiceCapCacheDirty;
+    }));
+
+    const KNotifyConfig config(QCoreApplication::applicationName(), QStringLiteral("testEvent"));
+
+    QImage image(64, 64, QImage::Format_ARGB32_Premultiplied);
+    image.fill(QColor(0x80, 0x40, 0x20, 0xff));
+
+    KNotification n(QStringLiteral("testEvent"), KNotification::Persistent | KNotification::ReleaseImageAfterDelivery);
+    n.setAutoDelete(false);
+    n.setText(QStringLiteral("Retained"));
+    n.setImage(image);
+    popup.notify(&n, config);
+
+    QVERIFY(waitForNotification([](const NotificationItem &item) {
+        return item.body == QLatin1String("Retained");
+    }));
+    QVERIFY(popup.m_retainedImages.contains(&n));
+
+    // expired rather than closed by the user, the notification itself stays around
+    Q_EMIT m_server->NotificationClosed(m_server->notifications.constLast().id, 1);
+    QVERIFY(QTest::qWaitFor([&popup, &n] {
+        return !popup.m_retainedImages.contains(&n);
+    }));
+}
+
+void KNotificationTest::imageOrderTest()
+{
+    // large enough for the conversion to take a while
+    QImage image(2048, 2048, QImage::Format_ARGB32_Premultiplied);
+    image.fill(QColor(0x10, 0x80, 0x40, 0xff));
+
+    KNotification *withImage = new KNotification(QStringLiteral("testEvent"));
+    withImage->setText(QStringLiteral("With image"));
+    withImage->setImage(image);
+    withImage->sendEvent();
+
+    KNotification *withoutImage = new KNotification(QStringLiteral("testEvent"));
+    withoutImage->setText(QStringLiteral("Without image"));
+    withoutImage->sendEvent();
+
+    QVERIFY(waitForNotification([](const NotificationItem &item) {
+        return item.body == QLatin1String("Without image");
+    }));
+
+    // the one sent later waits for the image of the earlier one
+    QCOMPARE(m_server->notifications.size(), 2);
+    QCOMPARE(m_server->notifications.at(0).body, QStringLiteral("With image"));
+    QCOMPARE(m_server->notifications.at(1).body, QStringLiteral("Without image"));
+}
+
+void KNotificationTest::imageTransportTest_data()
+{
+    QTest::addColumn<QString>("hint");
+
+    QTest::newRow("image_data") << QStringLiteral("image_data");
+    QTest::newRow("x-kde-image-fd") << QStringLiteral("x-kde-image-fd");
+    QTest::newRow("image-path") << QStringLiteral("image-path");
+}
+
+void KNotificationTest::imageTransportTest()
+{
+    QFETCH(QString, hint);
+
+    const bool passFd = hint == QLatin1String("x-kde-image-fd");
+    if (passFd && !QDBusConnection::sessionBus().connectionCapabilities().testFlag(QDBusConnection::UnixFileDescriptorPassing)) {
+        QSKIP("The bus does not support passing file descriptors");
+    }
+    if (passFd && !ImageConverter::fdVariantForImage(QImage(1, 1, QImage::Format_RGB32)).isValid()) {
+        QSKIP("No memfd support");
+    }
+
+    m_server->supportsImageFd = passFd;
+    auto resetServer = qScopeGuard([this] {
+        m_server->supportsImageFd = false;
+    });
+
+    NotifyByPopup popup;
+    popup.queryPopupServerCapabilities();
+    // the capabilities stored by an earlier run are those of the server before the change
+    QVERIFY(QTest::qWaitFor([&popup, passFd] {
+        return !popup.m_dbusServiceCapCacheDirty && !popup.m_capabilitiesQueryPending
+            && popup.m_popupServerCapabilities.contains(QLatin1String("x-kde-image-fd")) == passFd;
+    }));
+
+    const KNotifyConfig config(QCoreApplication::applicationName(), QStringLiteral("testEvent"));
+
+    QImage image(64, 64, QImage::Format_ARGB32_Premultiplied);
+    image.fill(QColor(0x20, 0x80, 0xc0, 0xff));
+    QObject parent;
+
+    // repeats of an image are sent by path once it is stored, new pixels are sent as they are
+    QVERIFY(QTest::qWaitFor([&] {
+        const qsizetype sent = m_server->notifications.size() + 1;
+        KNotification *n = new KNotification(QStringLiteral("testEvent"), KNotification::Persistent, &parent);
+        n->setImage(image.copy());
+        popup.sendNotificationToServer(n, config);
+        return QTest::qWaitFor([this, sent] {
+            return m_server->notifications.size() >= sent;
+        }) && m_server->notifications.constLast().hints.contains(hint);
+    }));
+
+    if (passFd) {
+        QCOMPARE(m_server->notifications.constLast().imageFdData.size(), 64 * 64 * 4);
+    }
+}
+
+void KNotificationTest::pixelConversionTest_data()
+{
+    QTest::addColumn<int>("kernel");
+    QTest::addColumn<int>("width");
+
+    const std::pair<const char *, PixelConversion::Kernel> kernels[] = {
+        {"scalar", PixelConversion::Kernel::Scalar},
+        {"SSE2", PixelConversion::Kernel::Sse2},
+        {"AVX2", PixelConversion::Kernel::Avx2},
+        {"NEON", PixelConversion::Kernel::Neon},
+    };
+    // less than a vector of any kernel, and whole vectors with all kinds of tails
+    const int widths[] = {1, 3, 7, 15, 17, 31, 33, 257};
+
+    for (const auto &[name, kernel] : kernels) {
+        for (int width : widths) {
+            QTest::addRow("%s, width %d", name, width) << int(kernel) << width;
+        }
+    }
+}
+
+void KNotificationTest::pixelConversionTest()
+{
+    QFETCH(int, kernel);
+    QFETCH(int, width);
+
+    // every alpha with every possible value of the color channels, which are never larger than it
+    QList<QRgb> pixels;
+    for (int a = 0; a < 256; ++a) {
+        for (int c = 0; c <= a; ++c) {
+            pixels.append(qRgba(c, a - c, c / 2, a));
+        }
+    }
+
+    const int height = (pixels.size() + width - 1) / width;
+    QImage image(width, height, QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::transparent);
+    for (qsizetype i = 0; i < pixels.size(); ++i) {
+        image.setPixel(i % width, i / width, pixels.at(i));
+    }
+
+    const QImage expected = image.convertToFormat(QImage::Format_RGBA8888);
+
+    QByteArray converted(qsizetype(width) * 4, Qt::Uninitialized);
+    QByteArray scalar(qsizetype(width) * 4, Qt::Uninitialized);
+    for (int y = 0; y < height; ++y) {
+        uchar *dst = reinterpret_cast<uchar *>(converted.data());
+        if (!PixelConversion::argb32PremultipliedToRgba8888(PixelConversion::Kernel(kernel), image.constScanLine(y), dst, width)) {
+            QSKIP("The kernel is not available on this machine");
+        }
+        QVERIFY(PixelConversion::argb32PremultipliedToRgba8888(PixelConversion::Kernel::Scalar, image.constScanLine(y), reinterpret_cast<uchar *>(scalar.data()), width));
+
+        // all kernels compute the same
+        QCOMPARE(converted, scalar);
+
+        // Qt's conversion rounds differently depending on the CPU, by one at most
+        const uchar *reference = expected.constScanLine(y);
+        for (int i = 0; i < width * 4; i += 4) {
+            const QByteArray where = QByteArray::number(i / 4) + ", " + QByteArray::number(y);
+            QVERIFY2(dst[i + 3] == reference[i + 3], where.constData());
+            if (dst[i + 3] == 0 || dst[i + 3] == 255) {
+                QVERIFY2(std::equal(dst + i, dst + i + 4, reference + i), where.constData());
+                continue;
+            }
+            for (int channel = 0; channel < 3; ++channel) {
+                QVERIFY2(std::abs(int(dst[i + channel]) - int(reference[i + channel])) <= 1, where.constData());
+            }
+        }
+    }
+}
+
+void KNotificationTest::toPlainTextTest_data()
+{
+    QTest::addColumn<QString>("text");
+
+    QTest::newRow("plain") << QStringLiteral("You have a new message from Alice");
+    QTest::newRow("markup") << QStringLiteral("<b>Alice</b> &amp; <i>Bob</i> wrote:<br/>Are you coming to the <a href=\"https://kde.org\">party</a> tonight? &#x1F389;");
+    QTest::newRow("paragraphs") << QStringLiteral("<p>Line 1 with <span style=\"color: red\">markup</span></p>\n<p>&lt;and&gt; entities</p>");
+    QTest::newRow("named entities") << QStringLiteral("&eacute;t&eacute; &Omega;&alpha;&thetasym; &hearts;&spades; &THORN;&thorn; &sup2;&frac34; &lArr;&rarr; &apos;&quot;");
+    QTest::newRow("non-breaking space") << QStringLiteral("a&nbsp;b &nbsp; c");
+    QTest::newRow("unknown entity") << QStringLiteral("&bogus; &amp;amp;");
+    QTest::newRow("numeric references") << QStringLiteral("&#65;&#x42;&#X43;&#0233;&#x00e9;");
+    QTest::newRow("surrogates") << QStringLiteral("&#x1F600; &#128512; \U0001F600");
+    QTest::newRow("unterminated tag") << QStringLiteral("abc<b");
+    QTest::newRow("unterminated closing tag") << QStringLiteral("<b>bold</b");
+    QTest::newRow("unterminated attribute") << QStringLiteral("abc<a href=\"x>y");
+    QTest::newRow("line breaks") << QStringLiteral("a<br>b<br/>c<BR />d");
+    QTest::newRow("blocks") << QStringLiteral("a<p>b</p>c<div>d</div><h1>e</h1><ul><li>f</li><li>g</li></ul>h<blockquote>i</blockquote>");
+    QTest::newRow("whitespace") << QStringLiteral("  a \t b\n\nc  <p>  d  </p>  ");
+}
+
+// gives the same result as the QTextDocument based conversion it replaced
+void KNotificationTest::toPlainTextTest()
+{
+    QFETCH(QString, text);
+
+    QCOMPARE(RichText::toPlainText(text), QTextDocumentFragment::fromHtml(text).toPlainText());
+}
+
+void KNotificationTest::normalizedMarkupTest()
+{
+    QCOMPARE(RichText::normalizedMarkup(QStringLiteral("<B>a</b> <font color=red><I>b &lt; <u>c</i></u> <a href='x?a=1&amp;b=\"2\"' onclick=\"y\">d</a><br>e<script>f</script>")),
+             QStringLiteral("<b>a</b> <i>b &lt; <u>c</u></i> <a href=\"x?a=1&amp;b=&quot;2&quot;\">d</a>\ne"));
+    QCOMPARE(RichText::normalizedMarkup(QStringLiteral("<b>abc <i>def</i></b>"), 6), QStringLiteral("<b>abc <i>d…</i></b>"));
+    // closing tags that match nothing are dropped, nested ones of the same name close the innermost
+    QCOMPARE(RichText::normalizedMarkup(QStringLiteral("<b>a</i></u>b</b></b>")), QStringLiteral("<b>ab</b>"));
+    QCOMPARE(RichText::normalizedMarkup(QStringLiteral("<b><b>a</b>b</b>")), QStringLiteral("<b><b>a</b>b</b>"));
+}
+
+void KNotificationTest::elidedTest()
+{
+    QCOMPARE(RichText::elided(QStringLiteral("abcdef"), 4), QStringLiteral("abc…"));
+    QCOMPARE(RichText::elided(QStringLiteral("abcd"), 4), QStringLiteral("abcd"));
+    // neither the combining accent nor half of the surrogate pair is left behind
+    QCOMPARE(RichText::elided(QStringLiteral("abe\u0301cd"), 4), QStringLiteral("ab…"));
+    QCOMPARE(RichText::elided(QStringLiteral("ab\U0001F600cd"), 4), QStringLiteral("ab…"));
+    QCOMPARE(RichText::toPlainText(QStringLiteral("abc<p>def</p>"), 5), QStringLiteral("abc…"));
+    QCOMPARE(RichText::toPlainText(QStringLiteral("abc<br><br>"), 3), QStringLiteral("abc"));
+    QCOMPARE(RichText::normalizedMarkup(QStringLiteral("<b>abc</b> def"), 3), QStringLiteral("<b>ab…</b>"));
 }
 
-QTEST_GUILESS_MAIN_SYSTEM_DBUS(KNotificationTest)
+QTEST_GUI_MAIN_SYSTEM_DBUS(KNotificationTest)
 #include "knotification_test.moc"
@@ -0,0 +1,665 @@
+/*
+    SPDX-FileCopyrightText: 2026 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+*/
+
+#include <QDBusConnection>
+#include <QGuiApplication>
+#include <QImage>
+#include <QObject>
+#include <QPointer>
+#include <QScopeGuard>
+#include <QStandardPaths>
+#include <QTest>
+#include <QThreadPool>
+#include <QTextDocumentFragment>
+
+#include <algorithm>
+
+#include "../src/imageconverter.h"
+#include "../src/knotification.h"
+#include "../src/knotificationmanager_p.h"
+#include "../src/knotifyconfig.h"
+#include "../src/notifybypopup.h"
+#include "../src/richtext.h"
+#include "fake_notifications_server.h"
+#include "qtest_dbus.h"
+
+/*
+ * Benchmarks for the hot paths of a notification: from KNotification::sendEvent()
+ * down to the Notify call on the (fake) notification server, and back out again
+ * when the notification is closed.
+ *
+ * Runs against a private session bus, see qtest_dbus.h.
+ */
+class KNotificationBenchmark : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+    void cleanup();
+
+    void benchmarkSendEvent();
+    void benchmarkManagerNotify();
+    void benchmarkSendNotificationToServer();
+    void benchmarkBurst();
+    void benchmarkRateLimit();
+    void benchmarkAggregatedBurst();
+    void benchmarkTaggedReplace();
+    void benchmarkFirstNotify_data();
+    void benchmarkFirstNotify();
+    void benchmarkClose();
+    void benchmarkVariantForImage_data();
+    void benchmarkVariantForImage();
+    void benchmarkConvertToFormat_data();
+    void benchmarkConvertToFormat();
+    void benchmarkImageTransport_data();
+    void benchmarkImageTransport();
+    void benchmarkUpdateReleasedImage();
+    void benchmarkScaledImage_data();
+    void benchmarkScaledImage();
+    void benchmarkStripRichText_data();
+    void benchmarkStripRichText();
+    void benchmarkNormalizedMarkup_data();
+    void benchmarkNormalizedMarkup();
+    void benchmarkElided_data();
+    void benchmarkElided();
+    void benchmarkReadEntry_data();
+    void benchmarkReadEntry();
+    void benchmarkConfigManyApplications();
+
+private:
+    // Waits until the server saw all Notify calls and the client processed all replies
+    bool waitForServer(qsizetype expectedCount);
+    void closeAllOnServer();
+
+    NotificationsServer *m_server = nullptr;
+};
+
+void KNotificationBenchmark::initTestCase()
+{
+    QStandardPaths::setTestModeEnabled(true);
+    const QString dataDir = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation);
+
+    QDir dir;
+    QVERIFY(dir.mkpath(dataDir + QStringLiteral("/knotifications6/")));
+
+    const QString notifyRc = dataDir + QStringLiteral("/knotifications6/qttest.notifyrc");
+    QFile::remove(notifyRc);
+    QVERIFY(QFile::copy(QFINDTESTDATA(QStringLiteral("knotifications6/qttest.notifyrc")), notifyRc));
+
+    // compiled notifyrc files and stored images from earlier runs
+    const QString cacheDir = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation);
+    QVERIFY(QDir(cacheDir + QStringLiteral("/knotifications6")).removeRecursively());
+
+    m_server = new NotificationsServer(this);
+
+    QVERIFY(QDBusConnection::sessionBus().registerService(QStringLiteral("org.freedesktop.Notifications")));
+    QVERIFY(QDBusConnection::sessionBus().registerObject(QStringLiteral("/org/freedesktop/Notifications"), m_server, QDBusConnection::ExportAllContents));
+}
+
+void KNotificationBenchmark::cleanupTestCase()
+{
+    const QString dataDir = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation);
+    QDir dir(dataDir + QStringLiteral("/knotifications6"));
+    QVERIFY(dir.removeRecursively());
+
+    const QString cacheDir = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation);
+    QVERIFY(QDir(cacheDir + QStringLiteral("/knotifications6")).removeRecursively());
+}
+
+void KNotificationBenchmark::cleanup()
+{
+    closeAllOnServer();
+}
+
+bool KNotificationBenchmark::waitForServer(qsizetype expectedCount)
+{
+    const bool ok = QTest::qWaitFor(
+        [this, expectedCount] {
+            return m_server->notifications.size() >= expectedCount;
+        },
+        30000);
+    // let the replies travel back to the client
+    QCoreApplication::processEvents();
+    QTest::qWait(50);
+    return ok;
+}
+
+void KNotificationBenchmark::closeAllOnServer()
+{
+    const auto notifications = m_server->notifications;
+    for (const NotificationItem &item : notifications) {
+        // reason 2 == "dismissed by the user", which also closes the KNotification
+        Q_EMIT m_server->NotificationClosed(item.id, 2);
+    }
+    m_server->notifications.clear();
+    QTest::qWait(50);
+}
+
+void KNotificationBenchmark::benchmarkSendEvent()
+{
+    qsizetype sent = 0;
+
+    QBENCHMARK {
+        KNotification *n = new KNotification(QStringLiteral("testEvent"), KNotification::Persistent);
+        n->setTitle(QStringLiteral("Benchmark"));
+        n->setText(QStringLiteral("Hello <b>World</b>"));
+        n->sendEvent();
+        ++sent;
+    }
+
+    QVERIFY(waitForServer(sent));
+}
+
+void KNotificationBenchmark::benchmarkManagerNotify()
+{
+    qsizetype sent = 0;
+
+    QBENCHMARK {
+        KNotification *n = new KNotification(QStringLiteral("testEvent"), KNotification::Persistent);
+        n->setText(QStringLiteral("Hello World"));
+        KNotificationManager::self()->notify(n);
+        ++sent;
+    }
+
+    QVERIFY(waitForServer(sent));
+}
+
+void KNotificationBenchmark::benchmarkSendNotificationToServer()
+{
+    NotifyByPopup popup;
+    popup.queryPopupServerCapabilities();
+    QVERIFY(QTest::qWaitFor([&popup] {
+        return !popup.m_dbusServiceCapCacheDirty;
+    }));
+
+    const KNotifyConfig config(QCoreApplication::applicationName(), QStringLiteral("testEvent"));
+
+    // calls for the same notification in one event loop iteration are merged, so use a new one each time
+    QObject parent;
+    qsizetype sent = 0;
+
+    QBENCHMARK {
+        KNotification *n = new KNotification(QStringLiteral("testEvent"), KNotification::Persistent, &parent);
+        n->setText(QStringLiteral("Hello World"));
+        QVERIFY(popup.sendNotificationToServer(n, config));
+        ++sent;
+    }
+
+    QVERIFY(waitForServer(sent));
+}
+
+void KNotificationBenchmark::benchmarkBurst()
+{
+    constexpr int count = 500;
+
+    NotifyByPopup popup;
+    popup.queryPopupServerCapabilities();
+    QVERIFY(QTest::qWaitFor([&popup] {
+        return !popup.m_dbusServiceCapCacheDirty;
+    }));
+
+    const KNotifyConfig config(QCoreApplication::applicationName(), QStringLiteral("testEvent"));
+
+    QBENCHMARK_ONCE {
+        QObject parent;
+        for (int i = 0; i < count; ++i) {
+            KNotification *n = new KNotification(QStringLiteral("testEvent"), KNotification::Persistent, &parent);
+            n->setText(QString::number(i));
+            QVERIFY(popup.sendNotificationToServer(n, config));
+        }
+
+        QVERIFY(QTest::qWaitFor(
+            [&popup] {
+                return popup.m_notifications.size() == count;
+            },
+            30000));
+    }
+}
+
+void KNotificationBenchmark::benchmarkRateLimit()
+{
+    // a flood of notifications of an event limited to bursts of 20
+    constexpr int count = 1000;
+
+    QBENCHMARK_ONCE {
+        for (int i = 0; i < count; ++i) {
+            KNotification *n = new KNotification(QStringLiteral("floodEvent"));
+            n->setText(QString::number(i));
+            n->sendEvent();
+        }
+    }
+
+    KNotification *critical = new KNotification(QStringLiteral("floodEvent"));
+    critical->setText(QStringLiteral("critical"));
+    critical->setUrgency(KNotification::CriticalUrgency);
+    critical->sendEvent();
+
+    QVERIFY(QTest::qWaitFor([this] {
+        return std::any_of(m_server->notifications.cbegin(), m_server->notifications.cend(), [](const NotificationItem &item) {
+            return item.body == QLatin1String("critical");
+        });
+    }));
+}
+
+void KNotificationBenchmark::benchmarkAggregatedBurst()
+{
+    // e.g. a mail client getting a lot of mail at once
+    constexpr int count = 200;
+
+    QObject parent;
+    QBENCHMARK_ONCE {
+        for (int i = 0; i < count; ++i) {
+            KNotification *n = new KNotification(QStringLiteral("burstEvent"), KNotification::Persistent, &parent);
+            n->setTitle(QString::number(i));
+            n->sendEvent();
+        }
+
+        QVERIFY(QTest::qWaitFor(
+            [this] {
+                return std::any_of(m_server->notifications.cbegin(), m_server->notifications.cend(), [](const NotificationItem &item) {
+                    return item.body.startsWith(QLatin1String("199\n198\n"));
+                });
+            },
+            30000));
+    }
+}
+
+void KNotificationBenchmark::benchmarkTaggedReplace()
+{
+    // e.g. a download reporting its progress with a new notification each time
+    constexpr int count = 200;
+
+    QObject parent;
+    QBENCHMARK_ONCE {
+        for (int i = 0; i < count; ++i) {
+            KNotification *n = new KNotification(QStringLiteral("testEvent"), KNotification::Persistent, &parent);
+            n->setTag(QStringLiteral("progress"));
+            n->setText(QString::number(i));
+            n->sendEvent();
+        }
+
+        QVERIFY(QTest::qWaitFor(
+            [this] {
+                return std::any_of(m_server->notifications.cbegin(), m_server->notifications.cend(), [](const NotificationItem &item) {
+                    return item.body == QLatin1String("199");
+                });
+            },
+            30000));
+    }
+}
+
+void KNotificationBenchmark::benchmarkFirstNotify_data()
+{
+    QTest::addColumn<bool>("cached");
+
+    QTest::newRow("cold") << false;
+    QTest::newRow("cached capabilities") << true;
+}
+
+void KNotificationBenchmark::benchmarkFirstNotify()
+{
+    QFETCH(bool, cached);
+
+    const QString fileName = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + QStringLiteral("/knotifications6/notificationserver");
+    if (cached) {
+        NotifyByPopup popup;
+        QVERIFY(QTest::qWaitFor([&fileName] {
+            return QFile::exists(fileName);
+        }));
+    }
+
+    const KNotifyConfig config(QCoreApplication::applicationName(), QStringLiteral("testEvent"));
+    QObject parent;
+    qsizetype sent = 0;
+
+    QBENCHMARK {
+        if (!cached) {
+            // the previous iteration may still be storing them
+            QThreadPool::globalInstance()->waitForDone();
+            QFile::remove(fileName);
+        }
+
+        // what a new process goes through for its first notification
+        NotifyByPopup popup;
+        KNotification *n = new KNotification(QStringLiteral("testEvent"), KNotification::Persistent, &parent);
+        n->setText(QStringLiteral("Hello World"));
+        popup.notify(n, config);
+        ++sent;
+        QVERIFY(QTest::qWaitFor([this, sent] {
+            return m_server->notifications.size() >= sent;
+        }));
+    }
+}
+
+void KNotificationBenchmark::benchmarkClose()
+{
+    constexpr int count = 200;
+
+    QBENCHMARK_ONCE {
+        QList<QPointer<KNotification>> notifications;
+        notifications.reserve(count);
+        for (int i = 0; i < count; ++i) {
+            KNotification *n = new KNotification(QStringLiteral("testEvent"), KNotification::Persistent);
+            n->setText(QString::number(i));
+            n->sendEvent();
+            notifications << n;
+        }
+
+        QVERIFY(waitForServer(count));
+
+        for (const QPointer<KNotification> &n : std::as_const(notifications)) {
+            if (n) {
+                n->close();
+            }
+        }
+
+        QVERIFY(QTest::qWaitFor([this] {
+            return m_server->notifications.isEmpty();
+        }));
+    }
+}
+
+void KNotificationBenchmark::benchmarkVariantForImage_data()
+{
+    QTest::addColumn<QSize>("size");
+    QTest::addColumn<QImage::Format>("format");
+
+    QTest::newRow("64 argb32-premultiplied") << QSize(64, 64) << QImage::Format_ARGB32_Premultiplied;
+    QTest::newRow("256 argb32-premultiplied") << QSize(256, 256) << QImage::Format_ARGB32_Premultiplied;
+    QTest::newRow("1024 argb32-premultiplied") << QSize(1024, 1024) << QImage::Format_ARGB32_Premultiplied;
+    QTest::newRow("256 argb32") << QSize(256, 256) << QImage::Format_ARGB32;
+    QTest::newRow("256 rgba8888") << QSize(256, 256) << QImage::Format_RGBA8888;
+    QTest::newRow("256 rgb32") << QSize(256, 256) << QImage::Format_RGB32;
+    QTest::newRow("256 rgb888") << QSize(256, 256) << QImage::Format_RGB888;
+}
+
+void KNotificationBenchmark::benchmarkVariantForImage()
+{
+    QFETCH(QSize, size);
+    QFETCH(QImage::Format, format);
+
+    QImage image(size, format);
+    image.fill(QColor(0x20, 0x80, 0xc0, 0xa0));
+
+    QBENCHMARK {
+        const QVariant variant = ImageConverter::variantForImage(image);
+        Q_UNUSED(variant);
+    }
+}
+
+void KNotificationBenchmark::benchmarkConvertToFormat_data()
+{
+    benchmarkVariantForImage_data();
+}
+
+// what variantForImage() used to do, as a baseline for it
+void KNotificationBenchmark::benchmarkConvertToFormat()
+{
+    QFETCH(QSize, size);
+    QFETCH(QImage::Format, format);
+
+    QImage image(size, format);
+    image.fill(QColor(0x20, 0x80, 0xc0, 0xa0));
+
+    QBENCHMARK {
+        const QImage converted = image.convertToFormat(image.hasAlphaChannel() ? QImage::Format_RGBA8888 : QImage::Format_RGB888);
+        const QByteArray data(reinterpret_cast<const char *>(converted.constBits()), converted.sizeInBytes());
+        Q_UNUSED(data);
+    }
+}
+
+void KNotificationBenchmark::benchmarkImageTransport_data()
+{
+    QTest::addColumn<QString>("hint");
+
+    QTest::newRow("image_data") << QStringLiteral("image_data");
+    QTest::newRow("x-kde-image-fd") << QStringLiteral("x-kde-image-fd");
+    QTest::newRow("image-path") << QStringLiteral("image-path");
+}
+
+void KNotificationBenchmark::benchmarkImageTransport()
+{
+    QFETCH(QString, hint);
+
+    const bool passFd = hint == QLatin1String("x-kde-image-fd");
+    if (passFd && !QDBusConnection::sessionBus().connectionCapabilities().testFlag(QDBusConnection::UnixFileDescriptorPassing)) {
+        QSKIP("The bus does not support passing file descriptors");
+    }
+    if (passFd && !ImageConverter::fdVariantForImage(QImage(1, 1, QImage::Format_RGB32)).isValid()) {
+        QSKIP("No memfd support");
+    }
+
+    m_server->supportsImageFd = passFd;
+    auto resetServer = qScopeGuard([this] {
+        m_server->supportsImageFd = false;
+    });
+
+    NotifyByPopup popup;
+    popup.queryPopupServerCapabilities();
+    // the capabilities stored by an earlier run are those of the server before the change
+    QVERIFY(QTest::qWaitFor([&popup, passFd] {
+        return !popup.m_dbusServiceCapCacheDirty && !popup.m_capabilitiesQueryPending
+            && popup.m_popupServerCapabilities.contains(QLatin1String("x-kde-image-fd")) == passFd;
+    }));
+
+    const KNotifyConfig config(QCoreApplication::applicationName(), QStringLiteral("testEvent"));
+
+    QImage image(256, 256, QImage::Format_ARGB32_Premultiplied);
+    image.fill(QColor(0x20, 0x80, 0xc0, 0xff));
+    QObject parent;
+    int sent = 0;
+
+    auto send = [&] {
+        // a new image each time, so that it is not just taken from the cache
+        KNotification *n = new KNotification(QStringLiteral("testEvent"), KNotification::Persistent, &parent);
+        n->setImage(image.copy());
+        QVERIFY(popup.sendNotificationToServer(n, config));
+        ++sent;
+        QVERIFY(QTest::qWaitFor([this, sent] {
+            return m_server->notifications.size() >= sent;
+        }));
+    };
+
+    if (hint == QLatin1String("image-path")) {
+        // repeats of an image are sent by path once it is stored
+        QVERIFY(QTest::qWaitFor([&] {
+            send();
+            return m_server->notifications.constLast().hints.contains(hint);
+        }));
+    }
+
+    QBENCHMARK {
+        if (hint != QLatin1String("image-path")) {
+            // new pixels each time, so that they are not found in the image store
+            image.setPixel(0, 0, qRgba(sent & 0xff, (sent >> 8) & 0xff, (sent >> 16) & 0xff, 0xff));
+        }
+        send();
+    }
+}
+
+void KNotificationBenchmark::benchmarkUpdateReleasedImage()
+{
+    QImage image(1024, 1024, QImage::Format_ARGB32_Premultiplied);
+    image.fill(QColor(0x40, 0x20, 0x80, 0xff));
+
+    KNotification *n = new KNotification(QStringLiteral("testEvent"), KNotification::Persistent | KNotification::ReleaseImageAfterDelivery);
+    n->setText(QStringLiteral("Hello World"));
+    n->setImage(image);
+    n->sendEvent();
+
+    qsizetype sent = m_server->notifications.size() + 1;
+    QVERIFY(waitForServer(sent));
+    QVERIFY(n->image().isNull());
+    // the benchmark holds a copy as well
+    image = QImage();
+
+    QBENCHMARK {
+        n->setText(QStringLiteral("Hello World %1").arg(sent));
+        n->update();
+        ++sent;
+        QVERIFY(QTest::qWaitFor([this, sent] {
+            return m_server->notifications.size() >= sent;
+        }));
+    }
+}
+
+void KNotificationBenchmark::benchmarkScaledImage_data()
+{
+    QTest::addColumn<QSize>("size");
+
+    QTest::newRow("256") << QSize(256, 256);
+    QTest::newRow("1024") << QSize(1024, 1024);
+    QTest::newRow("2000") << QSize(2000, 2000);
+}
+
+void KNotificationBenchmark::benchmarkScaledImage()
+{
+    QFETCH(QSize, size);
+
+    QImage image(size, QImage::Format_ARGB32_Premultiplied);
+    image.fill(QColor(0x20, 0x80, 0xc0, 0xa0));
+
+    QBENCHMARK {
+        const QVariant variant = ImageConverter::variantForImage(ImageConverter::scaledImage(image, 256));
+        Q_UNUSED(variant);
+    }
+}
+
+void KNotificationBenchmark::benchmarkStripRichText_data()
+{
+    QTest::addColumn<QString>("text");
+    QTest::addColumn<bool>("textDocument");
+    QTest::addColumn<bool>("repeated");
+
+    const QString plain = QStringLiteral("You have a new message from Alice, she says hello and asks whether you are coming tonight");
+    const QString markup = QStringLiteral("<b>Alice</b> &amp; <i>Bob</i> wrote:<br/>Are you coming to the <a href=\"https://kde.org\">party</a> tonight? &#x1F389;");
+    QString large;
+    for (int i = 0; i < 500; ++i) {
+        large += QStringLiteral("<p>Line %1 of the log, with <b>some</b> <span style=\"color: red\">markup</span> &lt;and&gt; entities</p>\n").arg(i);
+    }
+
+    for (const bool textDocument : {true, false}) {
+        const char *implementation = textDocument ? "QTextDocumentFragment" : "RichText";
+        QTest::addRow("%s plain", implementation) << plain << textDocument << false;
+        QTest::addRow("%s markup", implementation) << markup << textDocument << false;
+        QTest::addRow("%s markup repeated", implementation) << markup << textDocument << true;
+        QTest::addRow("%s large", implementation) << large << textDocument << false;
+    }
+}
+
+void KNotificationBenchmark::benchmarkStripRichText()
+{
+    QFETCH(QString, text);
+    QFETCH(bool, textDocument);
+    QFETCH(bool, repeated);
+
+    int i = 0;
+    QBENCHMARK {
+        // a different text each time, unless the cache for repeated texts is what is measured
+        const QString input = repeated ? text : text + QString::number(++i);
+        const QString plainText = textDocument ? QTextDocumentFragment::fromHtml(input).toPlainText() : RichText::toPlainText(input);
+        Q_UNUSED(plainText);
+    }
+}
+
+void KNotificationBenchmark::benchmarkNormalizedMarkup_data()
+{
+    QTest::addColumn<QString>("text");
+    QTest::addColumn<int>("maxLength");
+
+    QString large;
+    for (int i = 0; i < 500; ++i) {
+        large += QStringLiteral("<div class=\"row\"><table><tr><td><strong>%1</strong></td><td><a href=\"https://kde.org/?a=1&amp;b=2\">link</a> &amp; text</td></tr></table></div>").arg(i);
+    }
+
+    QTest::newRow("markup") << QStringLiteral("<b>Alice</b> wrote: <span style=\"x\">Are you <em>coming</em>?</span>") << 0;
+    QTest::newRow("large") << large << 0;
+    QTest::newRow("large limited") << large << 1000;
+}
+
+void KNotificationBenchmark::benchmarkNormalizedMarkup()
+{
+    QFETCH(QString, text);
+    QFETCH(int, maxLength);
+
+    int i = 0;
+    QBENCHMARK {
+        // a different text each time, so that it is not taken from the cache
+        const QString normalized = RichText::normalizedMarkup(text + QString::number(++i), maxLength);
+        Q_UNUSED(normalized);
+    }
+}
+
+void KNotificationBenchmark::benchmarkElided_data()
+{
+    QTest::addColumn<QString>("text");
+    QTest::addColumn<bool>("markup");
+
+    // what applications forwarding log output end up sending
+    QString log;
+    QString markupLog;
+    for (int i = 0; i < 100000; ++i) {
+        log += QStringLiteral("[%1] kernel: usb 1-1: new high-speed USB device number %1 using xhci_hcd\n").arg(i);
+        markupLog += QStringLiteral("<p><b>[%1]</b> kernel: usb 1-1: new <i>high-speed</i> USB device number %1</p>").arg(i);
+    }
+
+    QTest::newRow("plain") << log << false;
+    QTest::newRow("markup") << markupLog << true;
+}
+
+void KNotificationBenchmark::benchmarkElided()
+{
+    QFETCH(QString, text);
+    QFETCH(bool, markup);
+
+    // the default MaxBodyLength, texts this large are not cached
+    constexpr qsizetype maxLength = 16 * 1024;
+
+    QBENCHMARK {
+        const QString elided = markup ? RichText::normalizedMarkup(text, maxLength) : RichText::elided(text, maxLength);
+        Q_UNUSED(elided);
+    }
+}
+
+void KNotificationBenchmark::benchmarkReadEntry_data()
+{
+    QTest::addColumn<QString>("key");
+
+    QTest::newRow("existing key") << QStringLiteral("Action");
+    QTest::newRow("missing key") << QStringLiteral("Sound");
+}
+
+void KNotificationBenchmark::benchmarkReadEntry()
+{
+    QFETCH(QString, key);
+
+    const KNotifyConfig config(QStringLiteral("qttest"), QStringLiteral("testEvent"));
+
+    QBENCHMARK {
+        const QString value = config.readEntry(key);
+        Q_UNUSED(value);
+    }
+}
+
+void KNotificationBenchmark::benchmarkConfigManyApplications()
+{
+    constexpr int count = 50;
+
+    KNotifyConfig::reparseConfiguration();
+
+    QBENCHMARK {
+        for (int i = 0; i < count; ++i) {
+            const KNotifyConfig config(QStringLiteral("qttest") + QString::number(i), QStringLiteral("testEvent"));
+            const QString value = config.readEntry(QStringLiteral("Action"));
+            Q_UNUSED(value);
+        }
+    }
+}
+
+QTEST_GUI_MAIN_SYSTEM_DBUS(KNotificationBenchmark)
+#include "knotificationbenchmark.moc"
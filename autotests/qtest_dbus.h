@@ -13,7 +13,7 @@
 #include <stdlib.h>
 
 /* clang-format off */
-#define QTEST_GUILESS_MAIN_SYSTEM_DBUS(TestObject) \
+#define QTEST_DBUS_MAIN_IMPL(TestObject, ApplicationType) \
     int main(int argc, char *argv[]) \
     { \
         QProcess dbus; \
@@ -24,11 +24,11 @@
             qFatal("Couldn't execute new dbus session"); \
         } \
         int pos = session.indexOf('='); \
-        qputenv("DBUS_SESSION_BUS_ADDRESS", session.right(session.count() - pos - 1).trimmed().constData()); \
+        qputenv("DBUS_SESSION_BUS_ADDRESS", session.right(session.size() - pos - 1).trimmed().constData()); \
         session = dbus.readLine(); \
         pos = session.indexOf('='); \
-        QByteArray pid = session.right(session.count() - pos - 1).trimmed(); \
-        QCoreApplication app(argc, argv); \
+        QByteArray pid = session.right(session.size() - pos - 1).trimmed(); \
+        ApplicationType app(argc, argv); \
         app.setApplicationName(QLatin1String("qttest")); \
         TestObject tc; \
         int result = QTest::qExec(&tc, argc, argv); \
@@ -36,5 +36,10 @@
         dbus.waitForFinished(); \
         return result; \
     }
+
+#define QTEST_GUILESS_MAIN_SYSTEM_DBUS(TestObject) QTEST_DBUS_MAIN_IMPL(TestObject, QCoreApplication)
+
+// for tests that need a QGuiApplication, e.g. because they go through NotifyByPopup or use QPixmap
+#define QTEST_GUI_MAIN_SYSTEM_DBUS(TestObject) QTEST_DBUS_MAIN_IMPL(TestObject, QGuiApplication)
 /* clang-format on */
 #endif // KNOTIFICATIONS_QTEST_DBUS_H
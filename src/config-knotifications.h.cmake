@@ -1 +1,2 @@
 #cmakedefine WITH_SNORETOAST
+#cmakedefine HAVE_MEMFD
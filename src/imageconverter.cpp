@@ -6,10 +6,28 @@
 */
 
 #include "imageconverter.h"
+#include "debug_p.h"
+#include "knotifyconfig.h"
+#include "knotifyconfig_p.h"
+#include "pixelconversion.h"
+
+#include <config-knotifications.h>
 
 #include <QDBusArgument>
 #include <QDBusMetaType>
+#include <QDBusUnixFileDescriptor>
+#include <QGuiApplication>
 #include <QImage>
+#include <QtMath>
+
+#include <cstring>
+
+#ifdef HAVE_MEMFD
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 namespace ImageConverter
 {
@@ -22,6 +40,19 @@ struct SpecImage {
     bool hasAlpha;
     int bitsPerSample, channels;
     QByteArray data;
+
+    // keeps the pixels alive if data points into them, not marshalled
+    QImage image;
+};
+
+/*
+ * The same for the x-kde-image-fd hint, the pixels are read from fd
+ */
+struct SpecImageFd {
+    int width, height, rowStride;
+    bool hasAlpha;
+    int bitsPerSample, channels;
+    QDBusUnixFileDescriptor fd;
 };
 
 QDBusArgument &operator<<(QDBusArgument &argument, const SpecImage &image)
@@ -42,37 +73,215 @@ const QDBusArgument &operator>>(const QDBusArgument &argument, SpecImage &image)
     return argument;
 }
 
+QDBusArgument &operator<<(QDBusArgument &argument, const SpecImageFd &image)
+{
+    argument.beginStructure();
+    argument << image.width << image.height << image.rowStride << image.hasAlpha;
+    argument << image.bitsPerSample << image.channels << image.fd;
+    argument.endStructure();
+    return argument;
+}
+
+const QDBusArgument &operator>>(const QDBusArgument &argument, SpecImageFd &image)
+{
+    argument.beginStructure();
+    argument >> image.width >> image.height >> image.rowStride >> image.hasAlpha;
+    argument >> image.bitsPerSample >> image.channels >> image.fd;
+    argument.endStructure();
+    return argument;
+}
+
 } // namespace
 
 // This must be before the QVariant::fromValue below (#211726)
 Q_DECLARE_METATYPE(ImageConverter::SpecImage)
+Q_DECLARE_METATYPE(ImageConverter::SpecImageFd)
 
 namespace ImageConverter
 {
-QVariant variantForImage(const QImage &_image)
+static QImage::Format specFormat(const QImage &image)
 {
-    qDBusRegisterMetaType<SpecImage>();
-
-    const bool hasAlpha = _image.hasAlphaChannel();
-    QImage image;
-    if (hasAlpha) {
-        image = _image.convertToFormat(QImage::Format_RGBA8888);
-    } else {
-        image = _image.convertToFormat(QImage::Format_RGB888);
-    }
-
-    QByteArray data((const char *)image.constBits(), image.sizeInBytes());
+    return image.hasAlphaChannel() ? QImage::Format_RGBA8888 : QImage::Format_RGB888;
+}
 
+/*
+ * Returns the layout the spec wants for image, RGBA8888 or RGB888 with rows
+ * that are not padded, without any pixels yet
+ */
+static SpecImage specLayoutForImage(const QImage &image)
+{
     SpecImage specImage;
     specImage.width = image.width();
     specImage.height = image.height();
-    specImage.rowStride = image.bytesPerLine();
-    specImage.hasAlpha = hasAlpha;
+    specImage.hasAlpha = image.hasAlphaChannel();
     specImage.bitsPerSample = 8;
-    specImage.channels = hasAlpha ? 4 : 3;
-    specImage.data = data;
+    specImage.channels = specImage.hasAlpha ? 4 : 3;
+    specImage.rowStride = specImage.width * specImage.channels;
+    return specImage;
+}
+
+/*
+ * Writes the pixels of image to dst in the layout of specImage, dst must have
+ * room for specImage.rowStride * specImage.height bytes
+ */
+static void writeSpecPixels(const QImage &image, const SpecImage &specImage, uchar *dst)
+{
+    // what QPixmap::toImage() gives for most pixmaps, QImage::convertToFormat() goes through
+    // an intermediate buffer for it and the result has to be copied once more
+    if (image.format() == QImage::Format_ARGB32_Premultiplied) {
+        if (image.bytesPerLine() == specImage.rowStride) {
+            PixelConversion::argb32PremultipliedToRgba8888(image.constBits(), dst, qsizetype(image.width()) * image.height());
+        } else {
+            for (int y = 0; y < image.height(); ++y) {
+                PixelConversion::argb32PremultipliedToRgba8888(image.constScanLine(y), dst + qsizetype(y) * specImage.rowStride, image.width());
+            }
+        }
+        return;
+    }
+
+    // any other format is rare enough to not warrant a conversion of its own
+    const QImage::Format format = specFormat(image);
+    const QImage converted = image.format() == format ? image : image.convertToFormat(format);
+    if (converted.bytesPerLine() == specImage.rowStride) {
+        std::memcpy(dst, converted.constBits(), qsizetype(specImage.rowStride) * specImage.height);
+    } else {
+        for (int y = 0; y < converted.height(); ++y) {
+            std::memcpy(dst + qsizetype(y) * specImage.rowStride, converted.constScanLine(y), specImage.rowStride);
+        }
+    }
+}
+
+/*
+ * Returns image in the layout the spec wants, RGBA8888 or RGB888, writing
+ * straight into the data that is sent, or not copying anything at all if the
+ * image already has the right format
+ */
+static SpecImage specImageForImage(const QImage &image)
+{
+    SpecImage specImage = specLayoutForImage(image);
+
+    const QImage::Format format = specFormat(image);
+    if (image.format() == format) {
+        specImage.image = image;
+        specImage.rowStride = image.bytesPerLine();
+        specImage.data = QByteArray::fromRawData(reinterpret_cast<const char *>(image.constBits()), image.sizeInBytes());
+        return specImage;
+    }
+
+    if (image.format() == QImage::Format_ARGB32_Premultiplied) {
+        specImage.data = QByteArray(qsizetype(specImage.rowStride) * image.height(), Qt::Uninitialized);
+        writeSpecPixels(image, specImage, reinterpret_cast<uchar *>(specImage.data.data()));
+        return specImage;
+    }
+
+    specImage.image = image.convertToFormat(format);
+    specImage.rowStride = specImage.image.bytesPerLine();
+    specImage.data = QByteArray::fromRawData(reinterpret_cast<const char *>(specImage.image.constBits()), specImage.image.sizeInBytes());
+    return specImage;
+}
+
+QVariant variantForImage(const QImage &image)
+{
+    qDBusRegisterMetaType<SpecImage>();
+
+    return QVariant::fromValue(specImageForImage(image));
+}
+
+QVariant fdVariantForImage(const QImage &_image)
+{
+#ifdef HAVE_MEMFD
+    qDBusRegisterMetaType<SpecImageFd>();
+
+    const SpecImage image = specLayoutForImage(_image);
+    const qsizetype size = qsizetype(image.rowStride) * image.height;
+
+    const int fd = memfd_create("knotification-image", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        qCWarning(LOG_KNOTIFICATIONS) << "Failed to create memfd for notification image:" << strerror(errno);
+        return QVariant();
+    }
+
+    if (ftruncate(fd, size) < 0) {
+        qCWarning(LOG_KNOTIFICATIONS) << "Failed to resize notification image memfd:" << strerror(errno);
+        ::close(fd);
+        return QVariant();
+    }
+
+    // the pixels are converted right into the memfd rather than written to it from a buffer
+    if (size > 0) {
+        void *data = mmap(nullptr, size, PROT_WRITE, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            qCWarning(LOG_KNOTIFICATIONS) << "Failed to map notification image memfd:" << strerror(errno);
+            ::close(fd);
+            return QVariant();
+        }
+        writeSpecPixels(_image, image, static_cast<uchar *>(data));
+        // sealing against writes fails as long as it is mapped writable
+        munmap(data, size);
+    }
+
+    // the server must be able to rely on the contents not changing underneath it
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0) {
+        qCWarning(LOG_KNOTIFICATIONS) << "Failed to seal notification image memfd:" << strerror(errno);
+        ::close(fd);
+        return QVariant();
+    }
+
+    SpecImageFd specImage;
+    specImage.width = image.width;
+    specImage.height = image.height;
+    specImage.rowStride = image.rowStride;
+    specImage.hasAlpha = image.hasAlpha;
+    specImage.bitsPerSample = image.bitsPerSample;
+    specImage.channels = image.channels;
+    specImage.fd.giveFileDescriptor(fd);
 
     return QVariant::fromValue(specImage);
+#else
+    Q_UNUSED(_image);
+    return QVariant();
+#endif
+}
+
+int maxImageSize(const KNotifyConfig &config)
+{
+    // servers show images at icon size, this leaves plenty of room for showing them larger
+    constexpr int defaultSize = 256;
+
+    const QString entry = eventOrGlobalEntry(config, QStringLiteral("MaxImageSize"));
+
+    int size = defaultSize;
+    if (!entry.isEmpty()) {
+        bool ok = false;
+        size = entry.toInt(&ok);
+        if (!ok) {
+            size = defaultSize;
+        } else if (size <= 0) {
+            return 0;
+        }
+    }
+
+    // the size is in device independent pixels, the image should still look crisp on high DPI screens
+    const qreal devicePixelRatio = qGuiApp ? qGuiApp->devicePixelRatio() : 1.0;
+    return qCeil(size * devicePixelRatio);
+}
+
+QImage scaledImage(const QImage &image, int maxSize)
+{
+    if (maxSize <= 0 || (image.width() <= maxSize && image.height() <= maxSize)) {
+        return image;
+    }
+
+    const QSize targetSize = image.size().scaled(maxSize, maxSize, Qt::KeepAspectRatio).expandedTo(QSize(1, 1));
+
+    // Smooth scaling has to look at every source pixel, so shrink huge images cheaply
+    // to twice the target size first, which is still enough for a smooth result
+    QImage scaled = image;
+    if (image.width() > 4 * targetSize.width() || image.height() > 4 * targetSize.height()) {
+        scaled = image.scaled(targetSize * 2, Qt::IgnoreAspectRatio, Qt::FastTransformation);
+    }
+
+    return scaled.scaled(targetSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
 }
 
 } // namespace
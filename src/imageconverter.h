@@ -8,6 +8,9 @@
 #ifndef IMAGECONVERTER_H
 #define IMAGECONVERTER_H
 
+#include "knotifications_export.h"
+
+class KNotifyConfig;
 class QVariant;
 class QImage;
 
@@ -17,7 +20,27 @@ namespace ImageConverter
  * Returns a variant representing an image using the format describe in the
  * freedesktop.org spec
  */
-QVariant variantForImage(const QImage &image);
+KNOTIFICATIONS_TESTS_EXPORT QVariant variantForImage(const QImage &image);
+
+/*
+ * Returns a variant for the x-kde-image-fd hint, which is like the image_data hint
+ * except that the pixels are passed in a sealed memfd rather than inline
+ *
+ * Returns an invalid variant if no memfd could be created
+ */
+KNOTIFICATIONS_TESTS_EXPORT QVariant fdVariantForImage(const QImage &image);
+
+/*
+ * Returns the largest width or height in device pixels images sent along with
+ * notifications for config should have, or 0 if they should be sent as they are
+ */
+int maxImageSize(const KNotifyConfig &config);
+
+/*
+ * Returns image scaled down to fit into maxSize x maxSize, keeping its aspect ratio,
+ * or image itself if it fits already
+ */
+KNOTIFICATIONS_TESTS_EXPORT QImage scaledImage(const QImage &image, int maxSize);
 
 } // namespace
 
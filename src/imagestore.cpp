@@ -0,0 +1,245 @@
+/*
+    SPDX-FileCopyrightText: 2026 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+*/
+
+#include "imagestore.h"
+
+#include "debug_p.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QSaveFile>
+#include <QSet>
+#include <QStandardPaths>
+#include <QThreadPool>
+#include <QUrl>
+
+#include <algorithm>
+
+// the least recently used images are removed beyond that
+static constexpr qint64 s_maxStoreSize = 32 * 1024 * 1024;
+
+static QString storedFileName(const QString &directory, const QByteArray &hash)
+{
+    return directory + QLatin1Char('/') + QString::fromLatin1(hash) + QLatin1String(".png");
+}
+
+struct ImageStore::Index {
+    struct Entry {
+        qint64 size = 0;
+        // in milliseconds since the epoch, like the modification times of the files
+        qint64 lastUse = 0;
+    };
+
+    QMutex mutex;
+    // the stored images, initially those found in the directory by the first background job
+    QHash<QByteArray, Entry> entries;
+    qint64 totalSize = 0;
+    // images being written
+    QSet<QByteArray> pending;
+    // images looked up whose files still need to be touched, see touchFiles()
+    QSet<QByteArray> touched;
+    bool touchScheduled = false;
+
+    /*
+     * Drops the least recently used images until the store fits into s_maxStoreSize again,
+     * returns their hashes, the caller removes the files without holding the mutex
+     */
+    QList<QByteArray> evict()
+    {
+        QList<QByteArray> evicted;
+        if (totalSize <= s_maxStoreSize) {
+            return evicted;
+        }
+
+        QList<std::pair<qint64, QByteArray>> byUse;
+        byUse.reserve(entries.size());
+        for (auto it = entries.cbegin(); it != entries.cend(); ++it) {
+            byUse.append({it->lastUse, it.key()});
+        }
+        std::sort(byUse.begin(), byUse.end());
+
+        for (const auto &entry : std::as_const(byUse)) {
+            if (totalSize <= s_maxStoreSize) {
+                break;
+            }
+            totalSize -= entries.take(entry.second).size;
+            evicted.append(entry.second);
+        }
+        return evicted;
+    }
+
+    /*
+     * Updates the modification times of the images looked up since the last call, the
+     * time is all other processes go by when they pick images to evict
+     */
+    void touchFiles(const QString &directory)
+    {
+        QSet<QByteArray> hashes;
+        {
+            QMutexLocker locker(&mutex);
+            hashes.swap(touched);
+            touchScheduled = false;
+        }
+
+        const QDateTime now = QDateTime::currentDateTime();
+        for (const QByteArray &hash : std::as_const(hashes)) {
+            QFile file(storedFileName(directory, hash));
+            if (file.open(QIODevice::ReadWrite)) {
+                file.setFileTime(now, QFileDevice::FileModificationTime);
+                continue;
+            }
+
+            // evicted by another process, stop handing it out
+            if (!file.exists()) {
+                QMutexLocker locker(&mutex);
+                auto it = entries.find(hash);
+                if (it != entries.end() && !pending.contains(hash)) {
+                    totalSize -= it->size;
+                    entries.erase(it);
+                }
+            }
+        }
+    }
+};
+
+static void removeFiles(const QString &directory, const QList<QByteArray> &hashes)
+{
+    for (const QByteArray &hash : hashes) {
+        QFile::remove(storedFileName(directory, hash));
+    }
+}
+
+ImageStore::ImageStore()
+    : m_directory(QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + QLatin1String("/knotifications6/images"))
+    , m_index(std::make_shared<Index>())
+{
+    // the only time the directory is listed, everything else goes by the index
+    QThreadPool::globalInstance()->start([index = m_index, directory = m_directory] {
+        const QFileInfoList files = QDir(directory).entryInfoList({QStringLiteral("*.png")}, QDir::Files);
+
+        QList<QByteArray> evicted;
+        {
+            QMutexLocker locker(&index->mutex);
+            for (const QFileInfo &file : files) {
+                const QByteArray hash = file.completeBaseName().toLatin1();
+                if (index->entries.contains(hash)) {
+                    continue;
+                }
+                index->entries.insert(hash, Index::Entry{file.size(), file.lastModified().toMSecsSinceEpoch()});
+                index->totalSize += file.size();
+            }
+            evicted = index->evict();
+        }
+        removeFiles(directory, evicted);
+    });
+}
+
+ImageStore::~ImageStore() = default;
+
+QByteArray ImageStore::hash(const QImage &image)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+
+    const int header[] = {image.width(), image.height(), int(image.format())};
+    hash.addData(QByteArrayView(reinterpret_cast<const char *>(header), sizeof(header)));
+
+    // only hash the pixels, the padding at the end of the lines may contain anything
+    const qsizetype lineLength = (qsizetype(image.width()) * image.depth() + 7) / 8;
+    for (int y = 0; y < image.height(); ++y) {
+        hash.addData(QByteArrayView(reinterpret_cast<const char *>(image.constScanLine(y)), lineLength));
+    }
+
+    return hash.result().toHex();
+}
+
+QString ImageStore::fileName(const QByteArray &hash) const
+{
+    return storedFileName(m_directory, hash);
+}
+
+QString ImageStore::lookup(const QByteArray &hash) const
+{
+    {
+        QMutexLocker locker(&m_index->mutex);
+        if (!m_index->entries.contains(hash)) {
+            return QString();
+        }
+    }
+
+    // another process may have evicted it, the notification server must not get the path of nothing
+    const QString fileName = this->fileName(hash);
+    const bool exists = QFileInfo::exists(fileName);
+
+    QMutexLocker locker(&m_index->mutex);
+    auto it = m_index->entries.find(hash);
+    if (it == m_index->entries.end()) {
+        return QString();
+    }
+    if (!exists) {
+        if (!m_index->pending.contains(hash)) {
+            m_index->totalSize -= it->size;
+            m_index->entries.erase(it);
+        }
+        return QString();
+    }
+
+    // keeps it from being evicted, the file is touched in the background
+    it->lastUse = QDateTime::currentMSecsSinceEpoch();
+    m_index->touched.insert(hash);
+    if (!m_index->touchScheduled) {
+        m_index->touchScheduled = true;
+        QThreadPool::globalInstance()->start([index = m_index, directory = m_directory] {
+            index->touchFiles(directory);
+        });
+    }
+
+    return QUrl::fromLocalFile(fileName).toString();
+}
+
+void ImageStore::store(const QByteArray &hash, const QImage &image)
+{
+    {
+        QMutexLocker locker(&m_index->mutex);
+        if (m_index->pending.contains(hash) || m_index->entries.contains(hash)) {
+            return;
+        }
+        m_index->pending.insert(hash);
+    }
+
+    QThreadPool::globalInstance()->start([index = m_index, directory = m_directory, fileName = fileName(hash), hash, image] {
+        // possibly written by another process in the meantime
+        bool stored = QFileInfo::exists(fileName);
+        if (!stored) {
+            QDir().mkpath(directory);
+
+            // written atomically, the notification server must never see half an image
+            QSaveFile file(fileName);
+            stored = file.open(QIODevice::WriteOnly) && image.save(&file, "PNG") && file.commit();
+            if (!stored) {
+                qCDebug(LOG_KNOTIFICATIONS) << "Failed to store notification image" << fileName << file.errorString();
+            }
+        }
+
+        QList<QByteArray> evicted;
+        {
+            QMutexLocker locker(&index->mutex);
+            index->pending.remove(hash);
+            if (stored && !index->entries.contains(hash)) {
+                const qint64 size = QFileInfo(fileName).size();
+                index->entries.insert(hash, Index::Entry{size, QDateTime::currentMSecsSinceEpoch()});
+                index->totalSize += size;
+                evicted = index->evict();
+            }
+        }
+        removeFiles(directory, evicted);
+    });
+}
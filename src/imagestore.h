@@ -0,0 +1,66 @@
+/*
+    SPDX-FileCopyrightText: 2026 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+*/
+
+#ifndef IMAGESTORE_H
+#define IMAGESTORE_H
+
+#include <QByteArray>
+#include <QImage>
+#include <QString>
+
+#include <memory>
+
+/*
+ * A content-addressed store of notification images in XDG_CACHE_HOME.
+ *
+ * Applications tend to send the same image (e.g. a contact's avatar) with many
+ * notifications. Once such an image is stored, it can be passed to the notification
+ * server as an image-path hint, which is just its file name, rather than as pixels.
+ *
+ * Images are written in the background. The least recently used ones are removed
+ * once the store grows beyond its size limit. Which images are stored and when they
+ * were last used is kept in memory, so looking them up only checks that the file is
+ * still there, as other processes share the store and may have removed it.
+ */
+class ImageStore
+{
+public:
+    ImageStore();
+    ~ImageStore();
+
+    /*
+     * Returns a hash identifying the pixels of image
+     */
+    static QByteArray hash(const QImage &image);
+
+    /*
+     * Returns the file URL of the image with the given hash,
+     * or an empty string if it is not stored (yet) or was removed since.
+     *
+     * Images stored by earlier runs are only found once the store
+     * has listed its directory in the background.
+     */
+    QString lookup(const QByteArray &hash) const;
+
+    /*
+     * Stores image under the given hash, unless it is already stored.
+     * This happens in the background, lookup() does not find it right away.
+     */
+    void store(const QByteArray &hash, const QImage &image);
+
+private:
+    QString fileName(const QByteArray &hash) const;
+
+    struct Index;
+
+    QString m_directory;
+    // shared with the background jobs, which may outlive the store
+    std::shared_ptr<Index> m_index;
+
+    Q_DISABLE_COPY_MOVE(ImageStore)
+};
+
+#endif
@@ -174,18 +174,41 @@ QString KNotification::iconName() const
 
 QPixmap KNotification::pixmap() const
 {
+    if (d->pixmap.isNull() && !d->image.isNull()) {
+        d->pixmap = QPixmap::fromImage(d->image);
+    }
     return d->pixmap;
 }
 
 void KNotification::setPixmap(const QPixmap &pix)
 {
     d->needUpdate = true;
+    // the plugins only ever need the image, see Private::convertPixmap()
+    d->image = QImage();
+    d->imageKey = 0;
     d->pixmap = pix;
     if (d->id >= 0 && !d->isNew) {
         d->updateTimer.start();
     }
 }
 
+QImage KNotification::image() const
+{
+    d->convertPixmap();
+    return d->image;
+}
+
+void KNotification::setImage(const QImage &image)
+{
+    d->needUpdate = true;
+    d->image = image;
+    d->imageKey = image.isNull() ? 0 : image.cacheKey();
+    d->pixmap = QPixmap();
+    if (d->id >= 0 && !d->isNew) {
+        d->updateTimer.start();
+    }
+}
+
 QList<KNotificationAction *> KNotification::actions() const
 {
     return d->actions;
@@ -384,6 +407,19 @@ void KNotification::setUrgency(Urgency urgency)
     }
 }
 
+QString KNotification::tag() const
+{
+    return d->tag;
+}
+
+void KNotification::setTag(const QString &tag)
+{
+    if (d->tag != tag) {
+        d->tag = tag;
+        Q_EMIT tagChanged();
+    }
+}
+
 void KNotification::activate(const QString &actionId)
 {
     if (d->defaultAction && actionId == QLatin1String("default")) {
@@ -11,6 +11,7 @@
 
 #include <knotifications_export.h>
 
+#include <QImage>
 #include <QList>
 #include <QObject>
 #include <QPair>
@@ -156,6 +157,11 @@ class KNOTIFICATIONS_EXPORT KNotification : public QObject
      * \since 5.101
      */
     Q_PROPERTY(QVariantMap hints READ hints WRITE setHints NOTIFY hintsChanged)
+    /*!
+     * \property KNotification::tag
+     * \since 6.28
+     */
+    Q_PROPERTY(QString tag READ tag WRITE setTag NOTIFY tagChanged)
 
 public:
     /*!
@@ -167,6 +173,10 @@ public:
      * \value [since 5.18] SkipGrouping Sends a hint to Plasma to skip grouping for this notification.
      * \value [since 6.0] CloseWhenWindowActivated The notification will be automatically closed if the window() becomes activated. You need to set a window
      * using setWindow().
+     * \value [since 6.28] ReleaseImageAfterDelivery The image is released once it has been handed to the notification server,
+     * image() and pixmap() return a null image afterwards. Updates of the notification only keep showing it if the image could be
+     * written to the image cache in XDG_CACHE_HOME, otherwise they are shown without an image.
+     * Meant for long-lived notifications with large images, e.g. Persistent ones.
      * \value DefaultEvent The event is a standard kde event, and not an event of the application.
      */
     enum NotificationFlag {
@@ -175,6 +185,7 @@ public:
         LoopSound = 0x08,
         SkipGrouping = 0x10,
         CloseWhenWindowActivated = 0x20,
+        ReleaseImageAfterDelivery = 0x40,
         DefaultEvent = 0xF000,
     };
     Q_DECLARE_FLAGS(NotificationFlags, NotificationFlag)
@@ -305,9 +316,35 @@ public:
      * Set the pixmap that will be shown in the popup. If you want to use an icon from the icon theme use setIconName instead.
      *
      * \a pix the pixmap
+     *
+     * \sa setImage
      */
     void setPixmap(const QPixmap &pix);
 
+    /*!
+     * Returns the image shown in the popup
+     *
+     * If a pixmap was set, this is the image of it.
+     * This is a null image once it was released, see ReleaseImageAfterDelivery.
+     *
+     * \sa setImage
+     * \since 6.28
+     */
+    QImage image() const;
+    /*!
+     * Set the image that will be shown in the popup. If you want to use an icon from the icon theme use setIconName instead.
+     *
+     * Unlike a QPixmap, a QImage can be created in any thread, e.g. while decoding
+     * it in a worker thread. The notification plugins work with the image directly,
+     * so this also saves converting the pixmap.
+     *
+     * \a image the image
+     *
+     * \sa setPixmap
+     * \since 6.28
+     */
+    void setImage(const QImage &image);
+
     /*!
      * Returns the default action, or nullptr if none is set
      * \since 6.0
@@ -495,6 +532,31 @@ public:
      */
     QString xdgActivationToken() const;
 
+    /*!
+     * Returns the tag of the notification.
+     * \since 6.28
+     */
+    QString tag() const;
+
+    /*!
+     * Sets the tag of the notification.
+     *
+     * Sending a notification with the same tag as one of the application that is
+     * still shown replaces that one in place, rather than showing another notification,
+     * without having to keep the previous KNotification object around and update it.
+     * The previous notification is closed. This is meant for state that is reported over
+     * and over again, e.g. "3 new messages" or the current download progress.
+     *
+     * \note Replacing in place is supported by the notification server and the notification portal
+     * on Linux. On Android, macOS and Windows, the previous notification is closed and this one
+     * shown as a new notification instead.
+     *
+     * \a tag The tag, an empty one means the notification doesn't replace others
+     *
+     * \since 6.28
+     */
+    void setTag(const QString &tag);
+
 Q_SIGNALS:
     /*!
      * Emitted when the notification is closed.
@@ -574,6 +636,11 @@ Q_SIGNALS:
      * \since 5.101
      */
     void hintsChanged();
+    /*!
+     * Emitted when tag changed.
+     * \since 6.28
+     */
+    void tagChanged();
 
 public Q_SLOTS:
     /*!
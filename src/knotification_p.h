@@ -33,11 +33,16 @@ struct Q_DECL_HIDDEN KNotification::Private {
     bool ownsActions = true;
     QString xdgActivationToken;
     std::unique_ptr<KNotificationReplyAction> replyAction;
-    QPixmap pixmap;
+    QImage image;
+    // QImage::cacheKey() of image, still set once the pixels got released
+    qint64 imageKey = 0;
+    // set by setPixmap() until it is converted, or created from image if pixmap() is asked for
+    mutable QPixmap pixmap;
     NotificationFlags flags = KNotification::CloseOnTimeout;
     QString componentName;
     KNotification::Urgency urgency = KNotification::DefaultUrgency;
     QVariantMap hints;
+    QString tag;
 
     QTimer updateTimer;
     bool needUpdate = false;
@@ -45,6 +50,17 @@ struct Q_DECL_HIDDEN KNotification::Private {
     bool autoDelete = true;
     QWindow *window = nullptr;
     int actionIdCounter = 1;
+
+    // a pixmap set by setPixmap() is only converted once the image is needed
+    void convertPixmap()
+    {
+        if (image.isNull() && !pixmap.isNull()) {
+            image = pixmap.toImage();
+            imageKey = image.isNull() ? 0 : image.cacheKey();
+            // the image is what is kept from now on, pixmap() creates another one if asked for
+            pixmap = QPixmap();
+        }
+    }
 };
 
 #endif
@@ -14,17 +14,29 @@
 
 #include <config-knotifications.h>
 
+#include <QElapsedTimer>
 #include <QFileInfo>
 #include <QHash>
+#include <QPointer>
+#include <QSet>
+#include <QTimer>
+#include <QtMath>
+
+#include <algorithm>
+#include <functional>
+#include <utility>
 
 #ifdef HAVE_DBUS
 #include <QDBusConnection>
 #include <QDBusConnectionInterface>
+#include <QDBusPendingCallWatcher>
+#include <QDBusPendingReply>
 #endif
 
 #include "knotificationplugin.h"
 #include "knotificationreplyaction.h"
 #include "knotifyconfig.h"
+#include "knotifyconfig_p.h"
 
 #if defined(Q_OS_ANDROID)
 #include "notifybyandroid.h"
@@ -44,12 +56,120 @@
 
 typedef QHash<QString, QString> Dict;
 
+// notifications held back by rate limits beyond that are dropped instead
+static constexpr qsizetype s_maxDeferredNotifications = 100;
+
+// far more events than any application has, a daemon notifying for lots of them starts over beyond that
+static constexpr qsizetype s_maxRoutes = 256;
+
+// what a route adds to the cached notifyrc files its config refers to, see chargeKNotifyConfigCache()
+static constexpr qsizetype s_routeCost = 1024;
+
+/*
+ * How many notifications may be sent per second on average, and how many at once
+ */
+struct RateLimit {
+    double rate = 0;
+    double burst = 0;
+
+    bool isLimited() const
+    {
+        return rate > 0;
+    }
+};
+
+static RateLimit readRateLimit(const QString &rateEntry, const QString &burstEntry)
+{
+    RateLimit limit;
+    bool ok = false;
+    const double rate = rateEntry.toDouble(&ok);
+    if (!ok || rate <= 0) {
+        return limit;
+    }
+    limit.rate = rate;
+
+    // by default as many at once as in one second
+    const int burst = burstEntry.toInt(&ok);
+    limit.burst = ok && burst > 0 ? burst : std::max(1, qCeil(rate));
+    return limit;
+}
+
+struct TokenBucket {
+    double tokens = 0;
+    // when tokens was last refilled, in milliseconds, -1 for never
+    qint64 refilled = -1;
+
+    void refill(const RateLimit &limit, qint64 now)
+    {
+        tokens = refilled < 0 ? limit.burst : std::min(limit.burst, tokens + (now - refilled) * limit.rate / 1000.0);
+        refilled = now;
+    }
+
+    // milliseconds until there is a token to take
+    qint64 wait(const RateLimit &limit) const
+    {
+        return tokens >= 1 ? 0 : std::max<qint64>(1, qCeil((1 - tokens) * 1000 / limit.rate));
+    }
+};
+
+/*
+ * Everything notify() needs to know about an event, resolved once from its notifyrc entries
+ *
+ * The routes are charged against the budget of the cached notifyrc files, as their configs
+ * keep those files around.
+ */
+struct Q_DECL_HIDDEN KNotificationManager::Route {
+    // see knotifyConfigGeneration()
+    quint64 generation = 0;
+    // handed to the plugins
+    KNotifyConfig config;
+    // the plugins for the event's actions, in the order they are listed in
+    QList<KNotificationPlugin *> plugins;
+    // the urgency configured for the event, if any
+    KNotification::Urgency urgency = KNotification::DefaultUrgency;
+    // whether the event has an action at all, even one no plugin exists for
+    bool hasActions = false;
+    // the rate limits of the event and of the whole application
+    RateLimit eventLimit;
+    RateLimit appLimit;
+    // whether notifications over the limits are sent later rather than dropped
+    bool deferThrottled = false;
+};
+
 struct Q_DECL_HIDDEN KNotificationManager::Private {
     QHash<int, KNotification *> notifications;
+    // the other way round, as the id of a notification is already reset when it is closed
+    QHash<KNotification *, int> notificationIds;
     QHash<QString, KNotificationPlugin *> notifyPlugins;
 
+    // the plugins each notification was handed to and that did not finish it yet
+    QHash<KNotification *, QList<KNotificationPlugin *>> activePlugins;
+
+    // keyed by application name and event id
+    QHash<std::pair<QString, QString>, Route> routes;
+
+    // the latest notification of each tag, by application name and tag
+    QHash<std::pair<QString, QString>, QPointer<KNotification>> taggedNotifications;
+
     QStringList dirtyConfigCache;
     bool portalDBusServiceExists = false;
+    // whether the above is known yet, which decides the plugin for popups
+    bool portalDBusServiceKnown = true;
+    // notifications sent before it is known, each holding a reference until they are handed on
+    QList<QPointer<KNotification>> pendingNotifications;
+
+    // the token buckets of the rate limits, keyed by application name and event id, and application name
+    QElapsedTimer clock;
+    // see setRateLimitClock()
+    std::function<qint64()> fakeClock;
+    QHash<std::pair<QString, QString>, TokenBucket> eventBuckets;
+    QHash<QString, TokenBucket> appBuckets;
+    // notifications held back by the rate limits, each holding a reference until they are sent
+    QList<QPointer<KNotification>> deferredNotifications;
+    // those of them waiting for the limit of their application rather than the one of their event, by id,
+    // which unlike the address is not taken over by another notification once one is gone
+    QSet<int> appThrottled;
+    QTimer deferTimer;
 };
 
 class KNotificationManagerSingleton
@@ -71,10 +191,26 @@ KNotificationManager::KNotificationManager()
     qDeleteAll(d->notifyPlugins);
     d->notifyPlugins.clear();
 
+    d->clock.start();
+    d->deferTimer.setSingleShot(true);
+    connect(&d->deferTimer, &QTimer::timeout, this, &KNotificationManager::sendDeferredNotifications);
+
 #ifdef HAVE_DBUS
-    if (isInsideSandbox()) {
-        QDBusConnectionInterface *interface = QDBusConnection::sessionBus().interface();
-        d->portalDBusServiceExists = interface->isServiceRegistered(QStringLiteral("org.freedesktop.portal.Desktop"));
+    QDBusConnectionInterface *interface = QDBusConnection::sessionBus().interface();
+    if (isInsideSandbox() && interface) {
+        // don't block whoever happens to create the first notification on the bus,
+        // notifications wait for the answer instead, see notify()
+        d->portalDBusServiceKnown = false;
+        QDBusPendingCallWatcher *watcher =
+            new QDBusPendingCallWatcher(interface->asyncCall(QStringLiteral("NameHasOwner"), QStringLiteral("org.freedesktop.portal.Desktop")), this);
+        connect(watcher, &QDBusPendingCallWatcher::finished, this, [this](QDBusPendingCallWatcher *watcher) {
+            watcher->deleteLater();
+            const QDBusPendingReply<bool> reply = *watcher;
+            if (reply.isError()) {
+                qCWarning(LOG_KNOTIFICATIONS) << "Failed to check for the notification portal" << reply.error().message();
+            }
+            setPortalDBusServiceExists(!reply.isError() && reply.value());
+        });
     }
 
     QDBusConnection::sessionBus().connect(QString(),
@@ -133,12 +269,83 @@ KNotificationPlugin *KNotificationManager::pluginForAction(const QString &action
     return plugin;
 }
 
+const KNotificationManager::Route &KNotificationManager::route(const QString &appName, const QString &eventId)
+{
+    // the routes of an application go stale whenever its config files are reparsed
+    const quint64 generation = knotifyConfigGeneration(appName);
+
+    const std::pair<QString, QString> key{appName, eventId};
+    auto it = d->routes.constFind(key);
+    if (it != d->routes.constEnd() && it->generation == generation) {
+        return *it;
+    }
+
+    if (it == d->routes.constEnd()) {
+        if (d->routes.size() >= s_maxRoutes) {
+            chargeKNotifyConfigCache(-d->routes.size() * s_routeCost);
+            d->routes.clear();
+        }
+        chargeKNotifyConfigCache(s_routeCost);
+    }
+
+    Route route{generation, KNotifyConfig(appName, eventId)};
+    const KNotifyConfig &config = route.config;
+
+    if (!config.isValid()) {
+        qCWarning(LOG_KNOTIFICATIONS) << "No event config could be found for event id" << eventId << "under notifyrc file for app" << appName;
+    }
+
+    const QString notifyActions = config.readEntry(QStringLiteral("Action"));
+    route.hasActions = !notifyActions.isEmpty() && notifyActions != QLatin1String("None");
+
+    if (route.hasActions) {
+        const auto actionsList = notifyActions.split(QLatin1Char('|'));
+        for (const QString &action : actionsList) {
+            KNotificationPlugin *notifyPlugin = pluginForAction(action);
+            if (!notifyPlugin) {
+                qCDebug(LOG_KNOTIFICATIONS) << "No plugin for action" << action;
+                continue;
+            }
+            route.plugins.append(notifyPlugin);
+        }
+    }
+
+    const QString urgency = config.readEntry(QStringLiteral("Urgency"));
+    if (urgency == QLatin1String("Low")) {
+        route.urgency = KNotification::LowUrgency;
+    } else if (urgency == QLatin1String("Normal")) {
+        route.urgency = KNotification::NormalUrgency;
+    } else if (urgency == QLatin1String("High")) {
+        route.urgency = KNotification::HighUrgency;
+    } else if (urgency == QLatin1String("Critical")) {
+        route.urgency = KNotification::CriticalUrgency;
+    }
+
+    // the Global group limits all events of the application together
+    route.eventLimit = readRateLimit(config.readEntry(QStringLiteral("RateLimit")), config.readEntry(QStringLiteral("Burst")));
+    route.appLimit = readRateLimit(config.readGlobalEntry(QStringLiteral("RateLimit")), config.readGlobalEntry(QStringLiteral("Burst")));
+
+    route.deferThrottled = eventOrGlobalEntry(config, QStringLiteral("RateLimitPolicy")) == QLatin1String("Defer");
+
+    return *d->routes.insert(key, std::move(route));
+}
+
 void KNotificationManager::notifyPluginFinished(KNotification *notification)
 {
     if (!notification || !d->notifications.contains(notification->id())) {
         return;
     }
 
+    if (auto *plugin = qobject_cast<KNotificationPlugin *>(sender())) {
+        auto it = d->activePlugins.find(notification);
+        if (it != d->activePlugins.end()) {
+            it->removeOne(plugin);
+            if (it->isEmpty()) {
+                d->activePlugins.erase(it);
+            }
+        }
+    }
+
     notification->deref();
 }
 
@@ -190,14 +397,25 @@ void KNotificationManager::notificationClosed()
     if (!notification) {
         return;
     }
+    d->activePlugins.remove(notification);
+
     // We cannot do d->notifications.find(notification->id()); here because the
-    // notification->id() is -1 or -2 at this point, so we need to look for value
-    for (auto iter = d->notifications.begin(); iter != d->notifications.end(); ++iter) {
-        if (iter.value() == notification) {
-            d->notifications.erase(iter);
-            break;
-        }
+    // notification->id() is -1 or -2 at this point, so we need to look up its old id
+    const auto idIt = d->notificationIds.constFind(notification);
+    if (idIt == d->notificationIds.constEnd()) {
+        return;
+    }
+
+    auto iter = d->notifications.find(*idIt);
+    if (iter != d->notifications.end() && iter.value() == notification) {
+        d->notifications.erase(iter);
     }
+    d->appThrottled.remove(*idIt);
+    d->notificationIds.erase(idIt);
+
+    d->taggedNotifications.removeIf([notification](const auto &it) {
+        return it.value() == notification;
+    });
 }
 
 void KNotificationManager::close(int id)
@@ -206,44 +424,200 @@ void KNotificationManager::close(int id)
         KNotification *n = d->notifications.value(id);
         qCDebug(LOG_KNOTIFICATIONS) << "Closing notification" << id;
 
-        // Find plugins that are actually acting on this notification
-        // call close() only on those, otherwise each KNotificationPlugin::close()
-        // will call finish() which may close-and-delete the KNotification object
-        // before it finishes calling close on all the other plugins.
+        // the reference held while it was waiting, a re-emitted one may be with plugins still
+        if (d->pendingNotifications.removeOne(n) || d->deferredNotifications.removeOne(n)) {
+            d->appThrottled.remove(id);
+            n->deref();
+        }
+
+        // Call close() only on the plugins that are actually acting on this notification,
+        // otherwise each KNotificationPlugin::close() will call finish() which may
+        // close-and-delete the KNotification object before it finishes calling close
+        // on all the other plugins.
         // For example: Action=Popup is a single actions but there is 5 loaded
         // plugins, calling close() on the second would already close-and-delete
         // the notification
-        KNotifyConfig notifyConfig(n->appName(), n->eventId());
-        QString notifyActions = notifyConfig.readEntry(QStringLiteral("Action"));
-
-        const auto listActions = notifyActions.split(QLatin1Char('|'));
-        for (const QString &action : listActions) {
-            if (!d->notifyPlugins.contains(action)) {
-                qCDebug(LOG_KNOTIFICATIONS) << "No plugin for action" << action;
-                continue;
-            }
-
-            d->notifyPlugins[action]->close(n);
+        // The set changes as the plugins finish, so go through a copy.
+        const QList<KNotificationPlugin *> plugins = d->activePlugins.value(n);
+        for (KNotificationPlugin *plugin : plugins) {
+            plugin->close(n);
         }
     }
 }
 
+void KNotificationManager::holdNotification(KNotification *n, QList<QPointer<KNotification>> *list)
+{
+    if (list->contains(n)) {
+        return;
+    }
+
+    d->notifications.insert(n->id(), n);
+    d->notificationIds.insert(n, n->id());
+    n->ref();
+    list->append(n);
+    connect(n, &KNotification::closed, this, &KNotificationManager::notificationClosed, Qt::UniqueConnection);
+}
+
 void KNotificationManager::notify(KNotification *n)
 {
-    KNotifyConfig notifyConfig(n->appName(), n->eventId());
+    if (!d->portalDBusServiceKnown) {
+        holdNotification(n, &d->pendingNotifications);
+        return;
+    }
 
     if (d->dirtyConfigCache.contains(n->appName())) {
-        notifyConfig.reparseSingleConfiguration(n->appName());
+        KNotifyConfig::reparseSingleConfiguration(n->appName());
         d->dirtyConfigCache.removeOne(n->appName());
     }
 
-    if (!notifyConfig.isValid()) {
-        qCWarning(LOG_KNOTIFICATIONS) << "No event config could be found for event id" << n->eventId() << "under notifyrc file for app" << n->appName();
+    const Route &route = this->route(n->appName(), n->eventId());
+
+    if (route.hasActions && throttle(n, route)) {
+        return;
+    }
+
+    dispatch(n, route);
+}
+
+void KNotificationManager::setRateLimitClock(std::function<qint64()> now)
+{
+    d->fakeClock = std::move(now);
+}
+
+qint64 KNotificationManager::takeRateLimitToken(KNotification *n, const Route &route, bool *appWide)
+{
+    if (!route.eventLimit.isLimited() && !route.appLimit.isLimited()) {
+        return 0;
+    }
+
+    const qint64 now = d->fakeClock ? d->fakeClock() : d->clock.elapsed();
+    qint64 wait = 0;
+
+    TokenBucket *eventBucket = nullptr;
+    if (route.eventLimit.isLimited()) {
+        eventBucket = &d->eventBuckets[{n->appName(), n->eventId()}];
+        eventBucket->refill(route.eventLimit, now);
+        wait = eventBucket->wait(route.eventLimit);
+    }
+
+    TokenBucket *appBucket = nullptr;
+    if (route.appLimit.isLimited()) {
+        appBucket = &d->appBuckets[n->appName()];
+        appBucket->refill(route.appLimit, now);
+        const qint64 appWait = appBucket->wait(route.appLimit);
+        *appWide = appWait > 0;
+        wait = std::max(wait, appWait);
+    }
+
+    // only take a token if both buckets have one
+    if (wait > 0) {
+        return wait;
+    }
+    if (eventBucket) {
+        eventBucket->tokens -= 1;
+    }
+    if (appBucket) {
+        appBucket->tokens -= 1;
+    }
+    return 0;
+}
+
+bool KNotificationManager::throttle(KNotification *n, const Route &route)
+{
+    // what the user must see is never held back
+    const KNotification::Urgency urgency = n->urgency() == KNotification::DefaultUrgency ? route.urgency : n->urgency();
+    if (urgency == KNotification::CriticalUrgency) {
+        return false;
+    }
+
+    // the ones of the event held back already go first, and those of the application if its limit holds them back
+    const QString appName = n->appName();
+    const QString eventId = n->eventId();
+    bool queued = false;
+    bool appWide = false;
+    if (route.deferThrottled) {
+        for (const QPointer<KNotification> &deferred : std::as_const(d->deferredNotifications)) {
+            if (!deferred || deferred->appName() != appName) {
+                continue;
+            }
+            if (route.appLimit.isLimited() && d->appThrottled.contains(deferred->id())) {
+                queued = true;
+                appWide = true;
+                break;
+            }
+            queued = queued || deferred->eventId() == eventId;
+        }
+    }
+
+    const qint64 wait = queued ? 0 : takeRateLimitToken(n, route, &appWide);
+    if (!queued && wait == 0) {
+        return false;
+    }
+
+    if (route.deferThrottled && d->deferredNotifications.size() < s_maxDeferredNotifications) {
+        holdNotification(n, &d->deferredNotifications);
+        if (appWide) {
+            d->appThrottled.insert(n->id());
+        }
+        if (wait > 0 && (!d->deferTimer.isActive() || d->deferTimer.remainingTime() > wait)) {
+            d->deferTimer.start(wait);
+        }
+        return true;
+    }
+
+    qCDebug(LOG_KNOTIFICATIONS) << "Dropping notification" << n->eventId() << "of" << appName << "over its rate limit";
+    // this will cause KNotification closing itself fast
+    n->ref();
+    n->deref();
+    return true;
+}
+
+void KNotificationManager::sendDeferredNotifications()
+{
+    qint64 nextWait = -1;
+    // events with a notification that still has to wait, and applications whose limit makes one wait,
+    // the later notifications of those wait as well
+    QSet<std::pair<QString, QString>> waitingEvents;
+    QSet<QString> waitingApps;
+
+    const QList<QPointer<KNotification>> deferred = std::exchange(d->deferredNotifications, {});
+    d->appThrottled.clear();
+    for (const QPointer<KNotification> &n : deferred) {
+        if (!n) {
+            continue;
+        }
+
+        const std::pair<QString, QString> key{n->appName(), n->eventId()};
+        const Route &route = this->route(key.first, key.second);
+        bool appWide = route.appLimit.isLimited() && waitingApps.contains(key.first);
+        const bool waiting = appWide || waitingEvents.contains(key);
+        const qint64 wait = waiting || !route.hasActions ? 0 : takeRateLimitToken(n, route, &appWide);
+        if (waiting || wait > 0) {
+            d->deferredNotifications.append(n);
+            waitingEvents.insert(key);
+            if (appWide) {
+                waitingApps.insert(key.first);
+                d->appThrottled.insert(n->id());
+            }
+            if (wait > 0) {
+                nextWait = nextWait < 0 ? wait : std::min(nextWait, wait);
+            }
+            continue;
+        }
+
+        dispatch(n, route);
+        // the plugins hold their own references now
+        n->deref();
     }
 
-    const QString notifyActions = notifyConfig.readEntry(QStringLiteral("Action"));
+    if (!d->deferredNotifications.isEmpty()) {
+        d->deferTimer.start(std::max<qint64>(nextWait, 1));
+    }
+}
 
-    if (notifyActions.isEmpty() || notifyActions == QLatin1String("None")) {
+void KNotificationManager::dispatch(KNotification *n, const Route &route)
+{
+    if (!route.hasActions) {
         // this will cause KNotification closing itself fast
         n->ref();
         n->deref();
@@ -251,59 +625,95 @@ void KNotificationManager::notify(KNotification *n)
     }
 
     d->notifications.insert(n->id(), n);
+    d->notificationIds.insert(n, n->id());
 
-    // TODO KF6 d-pointer KNotifyConfig and add this there
     if (n->urgency() == KNotification::DefaultUrgency) {
-        const QString urgency = notifyConfig.readEntry(QStringLiteral("Urgency"));
-        if (urgency == QLatin1String("Low")) {
-            n->setUrgency(KNotification::LowUrgency);
-        } else if (urgency == QLatin1String("Normal")) {
-            n->setUrgency(KNotification::NormalUrgency);
-        } else if (urgency == QLatin1String("High")) {
-            n->setUrgency(KNotification::HighUrgency);
-        } else if (urgency == QLatin1String("Critical")) {
-            n->setUrgency(KNotification::CriticalUrgency);
+        if (route.urgency != KNotification::DefaultUrgency) {
+            n->setUrgency(route.urgency);
         }
         n->d->needUpdate = false;
     }
 
-    const auto actionsList = notifyActions.split(QLatin1Char('|'));
+    // the plugins may call back into the manager, which can invalidate the route
+    const QList<KNotificationPlugin *> plugins = route.plugins;
+    const KNotifyConfig notifyConfig = route.config;
 
     // Make sure all plugins can ref the notification
     // otherwise a plugin may finish and deref before everyone got a chance to ref
-    for (const QString &action : actionsList) {
-        KNotificationPlugin *notifyPlugin = pluginForAction(action);
+    for (qsizetype i = 0; i < plugins.size(); ++i) {
+        n->ref();
+    }
 
-        if (!notifyPlugin) {
-            qCDebug(LOG_KNOTIFICATIONS) << "No plugin for action" << action;
-            continue;
+    // a re-emitted notification may still be active in some of the plugins
+    QList<KNotificationPlugin *> &activePlugins = d->activePlugins[n];
+    for (KNotificationPlugin *notifyPlugin : plugins) {
+        if (!activePlugins.contains(notifyPlugin)) {
+            activePlugins.append(notifyPlugin);
         }
-
-        n->ref();
     }
 
-    for (const QString &action : actionsList) {
-        KNotificationPlugin *notifyPlugin = pluginForAction(action);
+    // a newer notification with the same tag takes the place of the previous one, wherever that is shown
+    QPointer<KNotification> previous;
+    if (!n->tag().isEmpty()) {
+        previous = std::exchange(d->taggedNotifications[{n->appName(), n->tag()}], n);
+    }
+    const QList<KNotificationPlugin *> previousPlugins = previous && previous != n ? d->activePlugins.value(previous) : QList<KNotificationPlugin *>();
 
-        if (!notifyPlugin) {
-            qCDebug(LOG_KNOTIFICATIONS) << "No plugin for action" << action;
-            continue;
+    for (KNotificationPlugin *notifyPlugin : plugins) {
+        if (previous && previousPlugins.contains(notifyPlugin) && d->activePlugins.value(previous).contains(notifyPlugin)) {
+            qCDebug(LOG_KNOTIFICATIONS) << "Calling replace on" << notifyPlugin->optionName();
+            notifyPlugin->replace(previous, n, notifyConfig);
+        } else {
+            qCDebug(LOG_KNOTIFICATIONS) << "Calling notify on" << notifyPlugin->optionName();
+            notifyPlugin->notify(n, notifyConfig);
         }
+    }
 
-        qCDebug(LOG_KNOTIFICATIONS) << "Calling notify on" << notifyPlugin->optionName();
-        notifyPlugin->notify(n, notifyConfig);
+    // and is gone from where the newer one is not shown
+    for (KNotificationPlugin *notifyPlugin : previousPlugins) {
+        if (previous && !plugins.contains(notifyPlugin) && d->activePlugins.value(previous).contains(notifyPlugin)) {
+            notifyPlugin->close(previous);
+        }
     }
 
-    connect(n, &KNotification::closed, this, &KNotificationManager::notificationClosed);
+    releaseImage(n, plugins);
+
+    connect(n, &KNotification::closed, this, &KNotificationManager::notificationClosed, Qt::UniqueConnection);
 }
 
 void KNotificationManager::update(KNotification *n)
 {
-    KNotifyConfig notifyConfig(n->appName(), n->eventId());
+    // plugins that never saw the notification, or are done with it, have nothing to update
+    const QList<KNotificationPlugin *> plugins = d->activePlugins.value(n);
+    if (plugins.isEmpty()) {
+        return;
+    }
 
-    for (KNotificationPlugin *p : std::as_const(d->notifyPlugins)) {
+    const KNotifyConfig notifyConfig = route(n->appName(), n->eventId()).config;
+    for (KNotificationPlugin *p : plugins) {
         p->update(n, notifyConfig);
     }
+
+    releaseImage(n, plugins);
+}
+
+void KNotificationManager::releaseImage(KNotification *n, const QList<KNotificationPlugin *> &plugins)
+{
+    if (!(n->flags() & KNotification::ReleaseImageAfterDelivery) || (n->d->image.isNull() && n->d->pixmap.isNull())) {
+        return;
+    }
+
+    // the plugins converting the image in the background hold a copy of it until they are done
+    const bool needed = std::any_of(plugins.cbegin(), plugins.cend(), [n](KNotificationPlugin *plugin) {
+        return plugin->needsImage(n);
+    });
+    if (needed) {
+        return;
+    }
+
+    // imageKey stays, so that the plugins can still find what they made of the image
+    n->d->image = QImage();
+    n->d->pixmap = QPixmap();
 }
 
 void KNotificationManager::reemit(KNotification *n)
@@ -311,6 +721,21 @@ void KNotificationManager::reemit(KNotification *n)
     notify(n);
 }
 
+void KNotificationManager::setPortalDBusServiceExists(bool exists)
+{
+    d->portalDBusServiceExists = exists;
+    d->portalDBusServiceKnown = true;
+
+    const QList<QPointer<KNotification>> pending = std::exchange(d->pendingNotifications, {});
+    for (const QPointer<KNotification> &n : pending) {
+        if (n) {
+            notify(n);
+            // the plugins hold their own references now
+            n->deref();
+        }
+    }
+}
+
 void KNotificationManager::reparseConfiguration(const QString &app)
 {
     if (!d->dirtyConfigCache.contains(app)) {
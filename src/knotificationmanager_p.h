@@ -10,14 +10,18 @@
 #define KNOTIFICATIONMANAGER_H
 
 #include <knotification.h>
+#include <knotifications_export.h>
 
+#include <QPointer>
+
+#include <functional>
 #include <memory>
 
 class KNotification;
 class QPixmap;
 class KNotificationPlugin;
 
-class KNotificationManager : public QObject
+class KNOTIFICATIONS_TESTS_EXPORT KNotificationManager : public QObject
 {
     Q_OBJECT
 public:
@@ -44,6 +48,12 @@ public:
      */
     void update(KNotification *n);
 
+    /*
+     * Makes the rate limits go by the milliseconds now returns rather than
+     * the time that passed, for testing them; an empty function resets that
+     */
+    void setRateLimitClock(std::function<qint64()> now);
+
     /*
      * re-emit the notification
      */
@@ -56,10 +66,47 @@ private Q_SLOTS:
     void notificationReplied(int id, const QString &text);
     void notifyPluginFinished(KNotification *notification);
     void reparseConfiguration(const QString &app);
+    void sendDeferredNotifications();
 
 private:
     bool isInsideSandbox();
 
+    struct Route;
+    const Route &route(const QString &appName, const QString &eventId);
+
+    /*
+     * Hands n to the plugins of its route
+     */
+    void dispatch(KNotification *n, const Route &route);
+
+    /*
+     * Keeps n in list with a reference, until it is handed on or closed
+     */
+    void holdNotification(KNotification *n, QList<QPointer<KNotification>> *list);
+
+    /*
+     * Takes a token from the rate limit buckets of n and returns 0,
+     * or returns the milliseconds until there is one
+     *
+     * appWide is set if the bucket of the application is one without a token.
+     */
+    qint64 takeRateLimitToken(KNotification *n, const Route &route, bool *appWide);
+
+    /*
+     * Holds n back or drops it if it is over its rate limits, returns whether it did
+     */
+    bool throttle(KNotification *n, const Route &route);
+
+    /*
+     * Releases the image of n if it asks for that and none of plugins needs it anymore
+     */
+    void releaseImage(KNotification *n, const QList<KNotificationPlugin *> &plugins);
+
+    /*
+     * Decides whether popups go to the portal, and hands on the notifications waiting for that
+     */
+    void setPortalDBusServiceExists(bool exists);
+
     struct Private;
     std::unique_ptr<Private> const d;
     KNotificationManager();
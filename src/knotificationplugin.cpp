@@ -32,6 +32,18 @@ void KNotificationPlugin::close(KNotification *notification)
     Q_EMIT finished(notification);
 }
 
+void KNotificationPlugin::replace(KNotification *previous, KNotification *notification, const KNotifyConfig &notifyConfig)
+{
+    close(previous);
+    notify(notification, notifyConfig);
+}
+
+bool KNotificationPlugin::needsImage(KNotification *notification) const
+{
+    Q_UNUSED(notification);
+    return false;
+}
+
 void KNotificationPlugin::finish(KNotification *notification)
 {
     Q_EMIT finished(notification);
@@ -7,8 +7,10 @@
 #ifndef KNOTIFICATIONPLUGIN_H
 #define KNOTIFICATIONPLUGIN_H
 
+#include "knotifications_export.h"
+#include "richtext.h"
+
 #include <QObject>
-#include <QTextDocumentFragment>
 
 #include <memory>
 
@@ -27,7 +29,7 @@ class KNotifyConfig;
  * You should reimplement the KNotificationPlugin::notify method to display the notification.
  *
  */
-class KNotificationPlugin : public QObject
+class KNOTIFICATIONS_TESTS_EXPORT KNotificationPlugin : public QObject
 {
     Q_OBJECT
 
@@ -66,6 +68,24 @@ public:
      */
     virtual void close(KNotification *notification);
 
+    /*!
+     * This function is called instead of notify() when the notification has the same tag as
+     * \a previous, which the plugin still shows
+     *
+     * Plugins that can show \a notification in place of \a previous reimplement this,
+     * they MUST call finish() for \a previous then, besides what notify() does.
+     * By default \a previous is closed and \a notification shown as a new one.
+     */
+    virtual void replace(KNotification *previous, KNotification *notification, const KNotifyConfig &notifyConfig);
+
+    /*!
+     * Whether the plugin still needs the pixels of the image of notification after
+     * notify() or update() returned, e.g. because it re-reads them for updates.
+     *
+     * Otherwise they get released if the notification has the ReleaseImageAfterDelivery flag.
+     */
+    virtual bool needsImage(KNotification *notification) const;
+
 protected:
     /*!
      * emit the finished signal
@@ -79,7 +99,7 @@ protected:
 
     static inline QString stripRichText(const QString &s)
     {
-        return QTextDocumentFragment::fromHtml(s).toPlainText();
+        return RichText::toPlainText(s);
     }
 
 Q_SIGNALS:
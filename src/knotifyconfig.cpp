@@ -6,15 +6,135 @@
 */
 
 #include "knotifyconfig.h"
+#include "knotifyconfig_p.h"
+#include "notifyrccache.h"
 
 #include <KConfigGroup>
 #include <KSharedConfig>
 
 #include <QCache>
+#include <QFileInfo>
+#include <QHash>
 #include <QStandardPaths>
 
-typedef QCache<QString, KSharedConfig::Ptr> ConfigCache;
-Q_GLOBAL_STATIC_WITH_ARGS(ConfigCache, static_cache, (15))
+#include <algorithm>
+
+/*
+ * A notifyrc file, either the user's configuration parsed by KConfig or
+ * the event file shipped by an application, in its compiled form or else parsed by KConfig.
+ */
+struct CachedConfig {
+    KSharedConfig::Ptr config;
+    std::shared_ptr<const NotifyRcCache> compiled;
+    KSharedConfig::Ptr events;
+};
+
+/*
+ * The notifyrc files shared by all KNotifyConfig instances, kept within a memory budget
+ * rather than a fixed number of files, as every application needs two of them.
+ */
+class ConfigCache
+{
+public:
+    // enough for the event files and user configuration of a few dozen applications
+    static constexpr qsizetype defaultBudget = 4 * 1024 * 1024;
+
+    ConfigCache()
+        : m_cache(defaultBudget)
+    {
+    }
+
+    CachedConfig *object(const QString &filename)
+    {
+        CachedConfig *cached = m_cache.object(filename);
+        if (cached) {
+            ++m_statistics.hits;
+        } else {
+            ++m_statistics.misses;
+        }
+        return cached;
+    }
+
+    void insert(const QString &filename, CachedConfig *cached, qsizetype cost)
+    {
+        const qsizetype countBefore = m_cache.size();
+        // an object costing more than the whole budget is deleted right away, the callers keep their own reference
+        const bool inserted = m_cache.insert(filename, cached, cost);
+        m_statistics.evictions += countBefore + (inserted ? 1 : 0) - m_cache.size();
+    }
+
+    void setMaxCost(qsizetype maxCost)
+    {
+        m_budget = maxCost;
+        applyBudget();
+    }
+
+    qsizetype maxCost() const
+    {
+        return m_budget;
+    }
+
+    void charge(qsizetype cost)
+    {
+        m_charged += cost;
+        applyBudget();
+    }
+
+    QCache<QString, CachedConfig> &cache()
+    {
+        return m_cache;
+    }
+
+    KNotifyConfig::CacheStatistics statistics() const
+    {
+        KNotifyConfig::CacheStatistics statistics = m_statistics;
+        statistics.count = m_cache.size();
+        statistics.cost = m_cache.totalCost() + m_charged;
+        statistics.maxCost = m_budget;
+        return statistics;
+    }
+
+    void resetStatistics()
+    {
+        m_statistics = KNotifyConfig::CacheStatistics();
+    }
+
+    quint64 generation(const QString &applicationName) const
+    {
+        return m_generation + m_appGenerations.value(applicationName);
+    }
+
+    void invalidate()
+    {
+        ++m_generation;
+    }
+
+    void invalidate(const QString &applicationName)
+    {
+        ++m_appGenerations[applicationName];
+    }
+
+private:
+    // what is charged from outside is taken off the budget of the cache itself
+    void applyBudget()
+    {
+        const qsizetype countBefore = m_cache.size();
+        m_cache.setMaxCost(std::max<qsizetype>(0, m_budget - m_charged));
+        m_statistics.evictions += countBefore - m_cache.size();
+    }
+
+    QCache<QString, CachedConfig> m_cache;
+    qsizetype m_budget = defaultBudget;
+    qsizetype m_charged = 0;
+    KNotifyConfig::CacheStatistics m_statistics;
+    // of all applications, and of each one on top of that
+    quint64 m_generation = 0;
+    QHash<QString, quint64> m_appGenerations;
+};
+Q_GLOBAL_STATIC(ConfigCache, static_cache)
+
+// bookkeeping of KConfig and friends that does not depend on the size of a file
+static constexpr qsizetype s_baseCost = 4 * 1024;
 
 class KNotifyConfigPrivate : public QSharedData
 {
@@ -24,7 +144,10 @@ public:
     QString applicationName;
     QString eventId;
 
+    // only one of these is set, see retrieve_events_from_cache()
     KSharedConfig::Ptr eventsFile;
+    std::shared_ptr<const NotifyRcCache> compiledEventsFile;
+
     KSharedConfig::Ptr configFile;
 };
 
@@ -38,59 +161,148 @@ QString KNotifyConfigPrivate::readEntry(const QString &group, const QString &key
         }
     }
 
+    if (compiledEventsFile) {
+        return compiledEventsFile->readEntry(group, key, path);
+    }
+
     if (eventsFile->hasGroup(group)) {
         KConfigGroup cg(eventsFile, group);
-        const QString value = path ? cg.readPathEntry(key, QString()) : cg.readEntry(key, QString());
-        if (!value.isNull()) {
-            return value;
-        }
+        // like the compiled file has them
+        return path ? NotifyRcCache::expandTilde(cg.readPathEntry(key, QString())) : cg.readEntry(key, QString());
     }
 
     return QString();
 }
 
-static KSharedConfig::Ptr retrieve_from_cache(const QString &filename, QStandardPaths::StandardLocation type = QStandardPaths::GenericConfigLocation)
+static KSharedConfig::Ptr retrieve_from_cache(const QString &filename)
 {
-    QCache<QString, KSharedConfig::Ptr> &cache = *static_cache;
-    if (cache.contains(filename)) {
-        return *cache[filename];
+    ConfigCache &cache = *static_cache;
+    if (CachedConfig *cached = cache.object(filename)) {
+        return cached->config;
     }
 
-    KSharedConfig::Ptr m = KSharedConfig::openConfig(filename, KConfig::NoGlobals, type);
-    // also search for event config files in qrc resources
-    if (type == QStandardPaths::GenericDataLocation) {
-        m->addConfigSources({QStringLiteral(":/") + filename});
+    KSharedConfig::Ptr m = KSharedConfig::openConfig(filename, KConfig::NoGlobals, QStandardPaths::GenericConfigLocation);
+
+    // KConfig keeps every entry around as UTF-16 strings
+    qsizetype cost = s_baseCost;
+    const QString path = QStandardPaths::locate(QStandardPaths::GenericConfigLocation, filename);
+    if (!path.isEmpty()) {
+        cost += QFileInfo(path).size() * qsizetype(sizeof(QChar));
     }
-    cache.insert(filename, new KSharedConfig::Ptr(m));
+    cache.insert(filename, new CachedConfig{m, nullptr, nullptr}, cost);
 
     return m;
 }
 
+/*
+ * The event files are looked up in their compiled form, which spares every process
+ * from parsing them, see NotifyRcCache. Only if that is unavailable KConfig parses them.
+ */
+static void retrieve_events_from_cache(const QString &applicationName, KSharedConfig::Ptr *events, std::shared_ptr<const NotifyRcCache> *compiled)
+{
+    const QString filename = QLatin1String("knotifications6/") + applicationName + QLatin1String(".notifyrc");
+
+    ConfigCache &cache = *static_cache;
+    if (CachedConfig *cached = cache.object(filename)) {
+        *events = cached->events;
+        *compiled = cached->compiled;
+        return;
+    }
+
+    if (auto compiledFile = NotifyRcCache::open(applicationName)) {
+        cache.insert(filename, new CachedConfig{nullptr, compiledFile, nullptr}, s_baseCost + compiledFile->size());
+        *compiled = std::move(compiledFile);
+        return;
+    }
+
+    KSharedConfig::Ptr m = KSharedConfig::openConfig(filename, KConfig::NoGlobals, QStandardPaths::GenericDataLocation);
+    // also search for event config files in qrc resources
+    m->addConfigSources({QLatin1String(":/") + filename});
+
+    // KConfig keeps every entry of every source file around as UTF-16 strings
+    qsizetype cost = s_baseCost;
+    const QStringList paths = QStandardPaths::locateAll(QStandardPaths::GenericDataLocation, filename);
+    for (const QString &path : paths) {
+        cost += QFileInfo(path).size() * qsizetype(sizeof(QChar));
+    }
+    cache.insert(filename, new CachedConfig{nullptr, nullptr, m}, cost);
+    *events = std::move(m);
+}
+
+QString eventOrGlobalEntry(const KNotifyConfig &config, const QString &key)
+{
+    const QString entry = config.readEntry(key);
+    return entry.isEmpty() ? config.readGlobalEntry(key) : entry;
+}
+
+quint64 knotifyConfigGeneration(const QString &applicationName)
+{
+    return static_cache->generation(applicationName);
+}
+
+void chargeKNotifyConfigCache(qsizetype cost)
+{
+    // whatever is given back on shutdown has nothing left to be charged against
+    if (!static_cache.isDestroyed()) {
+        static_cache->charge(cost);
+    }
+}
+
 void KNotifyConfig::reparseConfiguration()
 {
-    QCache<QString, KSharedConfig::Ptr> &cache = *static_cache;
+    static_cache->invalidate();
+
+    QCache<QString, CachedConfig> &cache = static_cache->cache();
     const auto listFiles = cache.keys();
     for (const QString &filename : listFiles) {
-        (*cache[filename])->reparseConfiguration();
+        CachedConfig *cached = cache.object(filename);
+        if (cached->config) {
+            cached->config->reparseConfiguration();
+        } else {
+            // opening it again checks whether it needs to be recompiled or parsed again
+            cache.remove(filename);
+        }
     }
 }
 
 void KNotifyConfig::reparseSingleConfiguration(const QString &app)
 {
-    QCache<QString, KSharedConfig::Ptr> &cache = *static_cache;
+    static_cache->invalidate(app);
+
+    QCache<QString, CachedConfig> &cache = static_cache->cache();
     const QString appCacheKey = app + QStringLiteral(".notifyrc");
-    if (cache.contains(appCacheKey)) {
-        (*cache[appCacheKey])->reparseConfiguration();
+    if (CachedConfig *cached = cache.object(appCacheKey)) {
+        cached->config->reparseConfiguration();
     }
 }
 
+void KNotifyConfig::setCacheBudget(qsizetype bytes)
+{
+    static_cache->setMaxCost(bytes);
+}
+
+qsizetype KNotifyConfig::cacheBudget()
+{
+    return static_cache->maxCost();
+}
+
+KNotifyConfig::CacheStatistics KNotifyConfig::cacheStatistics()
+{
+    return static_cache->statistics();
+}
+
+void KNotifyConfig::resetCacheStatistics()
+{
+    static_cache->resetStatistics();
+}
+
 KNotifyConfig::KNotifyConfig(const QString &applicationName, const QString &eventId)
     : d(new KNotifyConfigPrivate)
 {
     d->applicationName = applicationName;
     d->eventId = eventId;
 
-    d->eventsFile = retrieve_from_cache(QLatin1String("knotifications6/") + applicationName + QLatin1String(".notifyrc"), QStandardPaths::GenericDataLocation);
+    retrieve_events_from_cache(applicationName, &d->eventsFile, &d->compiledEventsFile);
     d->configFile = retrieve_from_cache(applicationName + QStringLiteral(".notifyrc"));
 }
 
@@ -120,7 +332,10 @@ QString KNotifyConfig::eventId() const
 bool KNotifyConfig::isValid() const
 {
     const QString group = QLatin1String("Event/") + d->eventId;
-    return d->configFile->hasGroup(group) || d->eventsFile->hasGroup(group);
+    if (d->configFile->hasGroup(group)) {
+        return true;
+    }
+    return d->compiledEventsFile ? d->compiledEventsFile->hasGroup(group) : d->eventsFile->hasGroup(group);
 }
 
 QString KNotifyConfig::readGlobalEntry(const QString &key) const
@@ -88,6 +88,79 @@ public:
      */
     static void reparseSingleConfiguration(const QString &app);
 
+    /*!
+     * \struct KNotifyConfig::CacheStatistics
+     * \inmodule KNotifications
+     *
+     * \brief Usage statistics of the notifyrc files cached by all KNotifyConfig instances.
+     *
+     * \since 6.28
+     */
+    struct CacheStatistics {
+        /*!
+         * How often a notifyrc file was found in the cache
+         */
+        qint64 hits = 0;
+        /*!
+         * How often a notifyrc file had to be opened because it was not in the cache
+         */
+        qint64 misses = 0;
+        /*!
+         * How many notifyrc files were dropped from the cache to stay within its budget
+         */
+        qint64 evictions = 0;
+        /*!
+         * The number of notifyrc files currently in the cache
+         */
+        qsizetype count = 0;
+        /*!
+         * The estimated memory used by the cached notifyrc files, in bytes,
+         * including the event configurations resolved from them that are kept around
+         */
+        qsizetype cost = 0;
+        /*!
+         * The memory budget of the cache, in bytes
+         */
+        qsizetype maxCost = 0;
+    };
+
+    /*!
+     * Sets the memory budget of the cache of parsed notifyrc files to \a bytes.
+     *
+     * Every application needs two files in the cache, its events file and
+     * its user configuration. A process notifying for many applications
+     * should raise the budget, so that they do not keep pushing each other
+     * out of the cache and are parsed over and over again.
+     *
+     * Lowering the budget evicts files right away if needed.
+     *
+     * \sa cacheStatistics()
+     * \since 6.28
+     */
+    static void setCacheBudget(qsizetype bytes);
+
+    /*!
+     * Returns the memory budget of the cache of parsed notifyrc files, in bytes
+     *
+     * \since 6.28
+     */
+    static qsizetype cacheBudget();
+
+    /*!
+     * Returns the statistics of the cache of parsed notifyrc files
+     *
+     * \sa resetCacheStatistics()
+     * \since 6.28
+     */
+    static CacheStatistics cacheStatistics();
+
+    /*!
+     * Resets the hit, miss and eviction counters of the cache of parsed notifyrc files
+     *
+     * \since 6.28
+     */
+    static void resetCacheStatistics();
+
 private:
     QSharedDataPointer<KNotifyConfigPrivate> d;
 };
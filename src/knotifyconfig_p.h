@@ -0,0 +1,32 @@
+/*
+    SPDX-FileCopyrightText: 2026 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+*/
+
+#ifndef KNOTIFYCONFIG_P_H
+#define KNOTIFYCONFIG_P_H
+
+#include <QtGlobal>
+
+class KNotifyConfig;
+class QString;
+
+/*
+ * Returns the entry key of the event, or of the Global group if the event does not have it
+ */
+QString eventOrGlobalEntry(const KNotifyConfig &config, const QString &key);
+
+/*
+ * Incremented whenever the cached notifyrc files of applicationName are reparsed, so that
+ * anything derived from their entries can tell that it needs to be read again.
+ */
+quint64 knotifyConfigGeneration(const QString &applicationName);
+
+/*
+ * Charges cost bytes against the budget of the cached notifyrc files, or gives them back if negative,
+ * for what is kept around outside of the cache, e.g. the configs of the routes of KNotificationManager
+ */
+void chargeKNotifyConfigCache(qsizetype cost);
+
+#endif
@@ -100,17 +100,17 @@ KNotificationData NotifyByAndroid::createAndroidNotification(KNotification *noti
 
     // icon
     {
-        QPixmap pixmap;
+        QImage image;
         if (!notification->iconName().isEmpty()) {
             const auto icon = QIcon::fromTheme(notification->iconName());
-            pixmap = icon.pixmap(32, 32);
+            image = icon.pixmap(32, 32).toImage();
         } else {
-            pixmap = notification->pixmap();
+            image = notification->image();
         }
         QByteArray iconData;
         QBuffer buffer(&iconData);
         buffer.open(QIODevice::WriteOnly);
-        pixmap.save(&buffer, "PNG");
+        image.save(&buffer, "PNG");
         n.callMethod<void>("setIconFromData", iconData);
     }
 
@@ -164,6 +164,13 @@ void NotifyByAndroid::update(KNotification *notification, const KNotifyConfig &n
     m_backend.callMethod<void>("notify", n);
 }
 
+bool NotifyByAndroid::needsImage(KNotification *notification) const
+{
+    // updates are built from scratch, including the image
+    Q_UNUSED(notification);
+    return true;
+}
+
 void NotifyByAndroid::close(KNotification *notification)
 {
     m_backend.callMethod<void>("close", notification->id(), notification->eventId());
@@ -29,6 +29,7 @@ public:
     void notify(KNotification *notification, const KNotifyConfig &notifyConfig) override;
     void update(KNotification *notification, const KNotifyConfig &notifyConfig) override;
     void close(KNotification *notification) override;
+    bool needsImage(KNotification *notification) const override;
 
     // interface from Java
     void notificationFinished(int id);
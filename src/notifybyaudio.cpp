@@ -130,6 +130,7 @@ void NotifyByAudio::notify(KNotification *notification, const KNotifyConfig &not
 
     Q_ASSERT(!m_notifications.value(m_currentId));
     m_notifications.insert(m_currentId, notification);
+    m_notificationIds.insert(notification, m_currentId);
 
     ++m_currentId;
 }
@@ -198,11 +199,12 @@ void NotifyByAudio::finishCallback(uint32_t id, int error_code)
 
 void NotifyByAudio::close(KNotification *notification)
 {
-    if (!m_notifications.values().contains(notification)) {
+    const auto idIt = m_notificationIds.constFind(notification);
+    if (idIt == m_notificationIds.constEnd()) {
         return;
     }
 
-    const auto id = m_notifications.key(notification);
+    const auto id = *idIt;
     if (m_context) {
         int ret = ca_context_cancel(m_context, id);
         if (ret != CA_SUCCESS) {
@@ -222,6 +224,9 @@ void NotifyByAudio::close(KNotification *notification)
 void NotifyByAudio::finishNotification(KNotification *notification, quint32 id)
 {
     m_notifications.remove(id);
+    if (m_notificationIds.value(notification) == id) {
+        m_notificationIds.remove(notification);
+    }
     m_loopSoundUrls.remove(id);
     finish(notification);
 }
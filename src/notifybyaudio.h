@@ -48,6 +48,7 @@ private:
     ca_context *m_context = nullptr;
     quint32 m_currentId = 0;
     QHash<quint32, KNotification *> m_notifications;
+    QHash<KNotification *, quint32> m_notificationIds;
     // in case we loop we store the URL for the notification to be able to replay it
     QHash<quint32, std::pair<QString, QUrl>> m_loopSoundUrls;
 
@@ -24,6 +24,7 @@ public:
     void notify(KNotification *notification, const KNotifyConfig &notifyConfig) override;
     void update(KNotification *notification, const KNotifyConfig &notifyConfig) override;
     void close(KNotification *notification) override;
+    bool needsImage(KNotification *notification) const override;
 };
 
 #endif // NOTIFYBYMACOSNOTIFICATIONCENTER_H
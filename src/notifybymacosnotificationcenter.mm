@@ -115,7 +115,7 @@ void NotifyByMacOSNotificationCenter::notify(KNotification *notification, const
         internalNotificationId, @"internalId", nil];
     osxNotification.informativeText = text;
 
-    if (notification->pixmap().isNull()) {
+    if (notification->image().isNull()) {
         QIcon notificationIcon = QIcon::fromTheme(notification->iconName());
         if (!notificationIcon.isNull()) {
             osxNotification.contentImage = [[NSImage alloc]
@@ -123,7 +123,7 @@ void NotifyByMacOSNotificationCenter::notify(KNotification *notification, const
         }
     } else {
         osxNotification.contentImage = [[NSImage alloc]
-            initWithCGImage: notification->pixmap().toImage().toCGImage() size: NSMakeSize(64, 64)];
+            initWithCGImage: notification->image().toCGImage() size: NSMakeSize(64, 64)];
     }
 
     if (notification->actions().isEmpty()) {
@@ -184,4 +184,11 @@ void NotifyByMacOSNotificationCenter::update(KNotification *notification, const
     notify(notification, notifyConfig);
 }
 
+bool NotifyByMacOSNotificationCenter::needsImage(KNotification *notification) const
+{
+    // updates are built from scratch, including the image
+    Q_UNUSED(notification);
+    return true;
+}
+
 #include "moc_notifybymacosnotificationcenter.cpp"
@@ -11,23 +11,56 @@
 #include "debug_p.h"
 #include "imageconverter.h"
 #include "knotification.h"
+#include "knotification_p.h"
 #include "knotificationreplyaction.h"
+#include "knotifyconfig_p.h"
+#include "richtext.h"
 
 #include <QDBusConnection>
+#include <QDBusPendingCallWatcher>
+#include <QDBusServiceWatcher>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
 #include <QGuiApplication>
 #include <QHash>
 #include <QIcon>
 #include <QMutableListIterator>
 #include <QPointer>
+#include <QPromise>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QThreadPool>
 #include <QUrl>
 
 #include <KConfigGroup>
 
+#include <algorithm>
+#include <utility>
+
+// enough for a few large images, which progress-style notifications keep sending with every update
+static constexpr qsizetype s_imageHintCacheSize = 16 * 1024 * 1024;
+
+// far more than any notification server shows without scrolling
+static constexpr qsizetype s_defaultMaxTitleLength = 1024;
+static constexpr qsizetype s_defaultMaxBodyLength = 16 * 1024;
+
+// how many of the notifications shown as one are listed
+static constexpr qsizetype s_aggregateLines = 5;
+
 NotifyByPopup::NotifyByPopup(QObject *parent)
     : KNotificationPlugin(parent)
+    , m_imageHintCache(s_imageHintCacheSize)
+    , m_imageStore(std::make_shared<ImageStore>())
     , m_dbusInterface(QStringLiteral("org.freedesktop.Notifications"), QStringLiteral("/org/freedesktop/Notifications"), QDBusConnection::sessionBus())
 {
     m_dbusServiceCapCacheDirty = true;
+    m_clock.start();
+
+    // Notify calls made in the same event loop iteration are sent together, see flushDispatchQueue()
+    m_dispatchTimer.setSingleShot(true);
+    m_dispatchTimer.setInterval(0);
+    connect(&m_dispatchTimer, &QTimer::timeout, this, &NotifyByPopup::flushDispatchQueue);
 
     connect(&m_dbusInterface, &org::freedesktop::Notifications::ActionInvoked, this, &NotifyByPopup::onNotificationActionInvoked);
     connect(&m_dbusInterface, &org::freedesktop::Notifications::ActivationToken, this, &NotifyByPopup::onNotificationActionTokenReceived);
@@ -37,6 +70,23 @@ NotifyByPopup::NotifyByPopup(QObject *parent)
     connect(&m_dbusInterface, &org::freedesktop::Notifications::NotificationReplied, this, &NotifyByPopup::onNotificationReplied);
 
     connect(&m_dbusInterface, &org::freedesktop::Notifications::NotificationClosed, this, &NotifyByPopup::onNotificationClosed);
+
+    // whatever a finished notification still needs is sent along with it once it is notified again
+    connect(this, &KNotificationPlugin::finished, this, [this](KNotification *notification) {
+        m_retainedImages.remove(notification);
+    });
+
+    // notifications go out right away with what the server supported the last time,
+    // which is checked in the background, and again whenever another server takes over
+    loadServerCapabilities();
+
+    QDBusServiceWatcher *watcher = new QDBusServiceWatcher(this);
+    watcher->setConnection(m_dbusInterface.connection());
+    watcher->setWatchMode(QDBusServiceWatcher::WatchForOwnerChange);
+    watcher->addWatchedService(m_dbusInterface.service());
+    connect(watcher, &QDBusServiceWatcher::serviceOwnerChanged, this, &NotifyByPopup::onServiceOwnerChanged);
+
+    refreshServerCapabilities();
 }
 
 NotifyByPopup::~NotifyByPopup()
@@ -44,17 +94,22 @@ NotifyByPopup::~NotifyByPopup()
     if (!m_notificationQueue.isEmpty()) {
         qCWarning(LOG_KNOTIFICATIONS) << "Had queued notifications on destruction. Was the eventloop running?";
     }
+
+    // don't drop what was already handed to us, the calls don't need us around for being delivered;
+    // the images being converted won't arrive anymore, so nothing waits for them
+    m_pendingImages.clear();
+    flushDispatchQueue();
 }
 
 void NotifyByPopup::notify(KNotification *notification, const KNotifyConfig &notifyConfig)
 {
     if (m_dbusServiceCapCacheDirty) {
-        // if we don't have the server capabilities yet, we need to query for them first;
+        // if we don't have the server capabilities yet, we need to wait for them;
         // as that is an async dbus operation, we enqueue the notification and process them
         // when we receive dbus reply with the server capabilities
         m_notificationQueue.append(qMakePair(notification, notifyConfig));
         queryPopupServerCapabilities();
-    } else {
+    } else if (!replaceTagged(notification, notifyConfig) && !joinAggregate(notification, notifyConfig)) {
         if (!sendNotificationToServer(notification, notifyConfig)) {
             finish(notification); // an error occurred.
         }
@@ -63,11 +118,35 @@ void NotifyByPopup::notify(KNotification *notification, const KNotifyConfig &not
 
 void NotifyByPopup::update(KNotification *notification, const KNotifyConfig &notifyConfig)
 {
+    // the notification shown for a burst lists all of them
+    if (const std::shared_ptr<Aggregate> aggregate = m_aggregates.value(notification); aggregate && aggregate->carrier) {
+        sendNotificationToServer(aggregate->carrier, aggregate->config, true);
+        return;
+    }
+
     sendNotificationToServer(notification, notifyConfig, true);
 }
 
+void NotifyByPopup::replace(KNotification *previous, KNotification *notification, const KNotifyConfig &notifyConfig)
+{
+    // taken up by replaceTagged(), possibly only once the server capabilities are known
+    m_replacedNotifications.insert(notification, previous);
+    notify(notification, notifyConfig);
+}
+
+bool NotifyByPopup::needsImage(KNotification *notification) const
+{
+    // nothing was done with the image yet while waiting for the server capabilities
+    return std::any_of(m_notificationQueue.cbegin(), m_notificationQueue.cend(), [notification](const QPair<KNotification *, KNotifyConfig> &item) {
+        return item.first == notification;
+    });
+}
+
 void NotifyByPopup::close(KNotification *notification)
 {
+    // before anything of it is dropped, it may still need to hand over the notification on the server
+    const bool othersShown = leaveAggregate(notification);
+
     QMutableListIterator<QPair<KNotification *, KNotifyConfig>> iter(m_notificationQueue);
     while (iter.hasNext()) {
         auto &item = iter.next();
@@ -76,7 +155,29 @@ void NotifyByPopup::close(KNotification *notification)
         }
     }
 
-    uint id = m_notifications.key(notification, 0);
+    m_dispatchQueue.removeIf([notification](const PendingNotify &pending) {
+        return pending.notification == notification;
+    });
+    removePendingImage(notification);
+    m_retainedImages.remove(notification);
+
+    // the one waiting to replace it is shown on its own instead
+    sendTagSuccessor(notification, 0);
+    m_tagSuccessors.removeIf([notification](const auto &it) {
+        return it->notification == notification;
+    });
+    m_replacedNotifications.remove(notification);
+    m_replacedNotifications.removeIf([notification](const auto &it) {
+        return it.value() == notification;
+    });
+
+    if (othersShown) {
+        // the server won't tell us about this one being closed
+        finish(notification);
+        return;
+    }
+
+    uint id = notificationId(notification);
 
     if (id == 0) {
         qCDebug(LOG_KNOTIFICATIONS) << "not found dbus id to close" << notification->id();
@@ -107,6 +208,15 @@ void NotifyByPopup::onNotificationActionInvoked(uint notificationId, const QStri
     }
 
     KNotification *n = *iter;
+    // whatever the action does with the notification shown for a burst, it is about the newest one of it,
+    // which is what is activated, the others are taken care of with that
+    const QList<QPointer<KNotification>> aggregated = takeAggregate(n);
+    for (KNotification *other : aggregated) {
+        if (other && other != n) {
+            Q_EMIT finished(other);
+        }
+    }
+
     if (n) {
         if (actionKey == QLatin1String("inline-reply") && n->replyAction()) {
             Q_EMIT replied(n->id(), QString());
@@ -114,7 +224,7 @@ void NotifyByPopup::onNotificationActionInvoked(uint notificationId, const QStri
             Q_EMIT actionInvoked(n->id(), actionKey);
         }
     } else {
-        m_notifications.erase(iter);
+        removeNotification(notificationId, nullptr);
     }
 }
 
@@ -125,7 +235,21 @@ void NotifyByPopup::onNotificationClosed(uint dbus_id, uint reason)
         return;
     }
     KNotification *n = *iter;
-    m_notifications.remove(dbus_id);
+    removeNotification(dbus_id, n);
+    m_replacedNotifications.removeIf([n](const auto &it) {
+        return it.value() == n;
+    });
+
+    // the others shown along with it are gone as well
+    const QList<QPointer<KNotification>> aggregated = takeAggregate(n);
+    for (KNotification *other : aggregated) {
+        if (other && other != n) {
+            Q_EMIT finished(other);
+            if (reason == 2) {
+                other->close();
+            }
+        }
+    }
 
     if (n) {
         Q_EMIT finished(n);
@@ -153,10 +277,414 @@ void NotifyByPopup::onNotificationReplied(uint notificationId, const QString &te
             Q_EMIT replied(n->id(), text);
         }
     } else {
-        m_notifications.erase(iter);
+        removeNotification(notificationId, nullptr);
+    }
+}
+
+bool NotifyByPopup::passImageFd() const
+{
+    // passing the pixels in a memfd spares the bus daemon copying them around
+    return m_popupServerCapabilities.contains(QLatin1String("x-kde-image-fd"))
+        && m_dbusInterface.connection().connectionCapabilities().testFlag(QDBusConnection::UnixFileDescriptorPassing);
+}
+
+const NotifyByPopup::ImageHint *NotifyByPopup::cachedImageHint(const ImageKey &key)
+{
+    ImageHint *cached = m_imageHintCache.object(key);
+    if (!cached) {
+        return nullptr;
+    }
+
+    // the image may have been stored since, or evicted from the store
+    const QString path = m_imageStore->lookup(cached->hash);
+    if (!path.isEmpty()) {
+        cached->name = QStringLiteral("image-path");
+        cached->value = path;
+        return cached;
+    }
+
+    const QString name = passImageFd() ? QStringLiteral("x-kde-image-fd") : QStringLiteral("image_data");
+    return cached->name == name ? cached : nullptr;
+}
+
+QString NotifyByPopup::retainedImagePath(KNotification *notification, const ImageKey &key) const
+{
+    const auto it = m_retainedImages.constFind(notification);
+    if (it == m_retainedImages.constEnd() || it->notification != notification || it->key != key) {
+        return QString();
+    }
+
+    // the pixels are gone, if they could not be stored the update goes without them
+    return m_imageStore->lookup(it->hash);
+}
+
+void NotifyByPopup::retainImage(KNotification *notification, const ImageKey &key, const QByteArray &hash)
+{
+    if (notification->flags() & KNotification::ReleaseImageAfterDelivery) {
+        m_retainedImages.insert(notification, RetainedImage{notification, key, hash});
+    }
+}
+
+void NotifyByPopup::convertImage(KNotification *notification, const ImageKey &key, QVariantList &&arguments, bool update)
+{
+    const quint64 sequence = ++m_imageSequence;
+    m_pendingImages.insert(notification, PendingImage{sequence, update, notification->appName()});
+
+    auto conversion = m_imageConversions.find(key);
+    if (conversion == m_imageConversions.end()) {
+        // the image is implicitly shared, the worker thread gets a snapshot of it
+        auto promise = std::make_shared<QPromise<ImageHint>>();
+        QThreadPool::globalInstance()->start([promise, image = notification->image(), maxSize = key.second, passFd = passImageFd(), store = m_imageStore] {
+            promise->start();
+            promise->addResult(imageHint(image, maxSize, passFd, store.get()));
+            promise->finish();
+        });
+
+        auto cache = [this, key](const ImageHint &hint) {
+            // each fd hint holds an open memfd, a cache full of small ones would run the process out of fds
+            if (hint.name != QLatin1String("x-kde-image-fd")) {
+                m_imageHintCache.insert(key, new ImageHint(hint), hint.cost);
+            }
+            m_imageConversions.remove(key);
+            return hint;
+        };
+        conversion = m_imageConversions.insert(key, promise->future().then(this, std::move(cache)));
+    }
+
+    auto queue = [this, notification, guard = QPointer<KNotification>(notification), sequence, key, arguments = std::move(arguments)](
+                     const ImageHint &hint) mutable {
+        const auto it = m_pendingImages.constFind(notification);
+        if (it == m_pendingImages.constEnd() || it->sequence != sequence) {
+            // superseded by a newer state of the notification, or closed
+            return;
+        }
+        const bool update = it->update;
+        removePendingImage(notification);
+
+        if (!guard) {
+            return;
+        }
+
+        QVariantMap hints = arguments[6].toMap();
+        hints.insert(hint.name, hint.value);
+        arguments[6] = hints;
+        retainImage(notification, key, hint.hash);
+
+        queueNotify(notification, std::move(arguments), update, sequence);
+    };
+
+    // only runs if we are still around, the future is copied as the conversion removes itself
+    QFuture<ImageHint>(*conversion).then(this, std::move(queue));
+}
+
+NotifyByPopup::ImageHint NotifyByPopup::imageHint(const QImage &original, int maxSize, bool passFd, ImageStore *store)
+{
+    // scaling down first also spares converting and marshalling pixels the server throws away anyway
+    const QImage image = ImageConverter::scaledImage(original, maxSize);
+
+    // applications tend to send the same image over and over again, but not necessarily the same QImage
+    const QByteArray hash = ImageStore::hash(image);
+    if (const QString path = store->lookup(hash); !path.isEmpty()) {
+        return ImageHint{QStringLiteral("image-path"), path, hash, path.size() * qsizetype(sizeof(QChar))};
+    }
+
+    // send the pixels this time, once stored the next notification with them only needs the path
+    store->store(hash, image);
+
+    // the converted pixels are about the size of the original ones
+    if (passFd) {
+        const QVariant value = ImageConverter::fdVariantForImage(image);
+        if (value.isValid()) {
+            return ImageHint{QStringLiteral("x-kde-image-fd"), value, hash, image.sizeInBytes()};
+        }
+    }
+
+    return ImageHint{QStringLiteral("image_data"), ImageConverter::variantForImage(image), hash, image.sizeInBytes()};
+}
+
+bool NotifyByPopup::removePendingImage(KNotification *notification)
+{
+    if (!m_pendingImages.remove(notification)) {
+        return false;
+    }
+
+    if (!m_dispatchQueue.isEmpty() && !m_dispatchTimer.isActive()) {
+        m_dispatchTimer.start();
+    }
+    return true;
+}
+
+uint NotifyByPopup::notificationId(KNotification *notification) const
+{
+    const uint id = m_notificationIds.value(notification, 0);
+    // the address may belong to a notification that was deleted while on the server
+    if (id == 0 || m_notifications.value(id) != notification) {
+        return 0;
+    }
+    return id;
+}
+
+void NotifyByPopup::insertNotification(uint id, KNotification *notification)
+{
+    // the notification on the server is handed over from another one, which is not on it anymore
+    if (KNotification *previous = m_notifications.value(id); previous && previous != notification) {
+        auto it = m_notificationIds.find(previous);
+        if (it != m_notificationIds.end() && *it == id) {
+            m_notificationIds.erase(it);
+        }
+    }
+
+    m_notifications.insert(id, notification);
+    m_notificationIds.insert(notification, id);
+}
+
+void NotifyByPopup::removeNotification(uint id, KNotification *notification)
+{
+    m_notifications.remove(id);
+
+    if (notification) {
+        auto it = m_notificationIds.find(notification);
+        if (it != m_notificationIds.end() && *it == id) {
+            m_notificationIds.erase(it);
+        }
+        m_retainedImages.remove(notification);
+    } else {
+        // the notification is gone already, only its id is left to find the entry by
+        m_notificationIds.removeIf([id](QHash<KNotification *, uint>::iterator it) {
+            return *it == id;
+        });
+        m_retainedImages.removeIf([](QHash<KNotification *, RetainedImage>::iterator it) {
+            return !it->notification;
+        });
     }
 }
 
+/*
+ * Returns the entry key as a boolean, the way KConfigGroup::readEntry() reads them
+ */
+static bool boolEntry(const KNotifyConfig &config, const QString &key)
+{
+    const QString entry = eventOrGlobalEntry(config, key).toLower();
+    return entry == QLatin1String("true") || entry == QLatin1String("on") || entry == QLatin1String("yes") || entry == QLatin1String("1");
+}
+
+/*
+ * Returns the entry key as a length, 0 meaning there is no limit, or defaultLength if it is not set
+ */
+static qsizetype lengthEntry(const KNotifyConfig &config, const QString &key, qsizetype defaultLength)
+{
+    bool ok = false;
+    const qsizetype length = eventOrGlobalEntry(config, key).toLongLong(&ok);
+    return ok ? std::max<qsizetype>(length, 0) : defaultLength;
+}
+
+bool NotifyByPopup::replaceTagged(KNotification *notification, const KNotifyConfig &config)
+{
+    KNotification *previous = m_replacedNotifications.take(notification);
+    if (!previous || previous == notification) {
+        return false;
+    }
+
+    // the previous one is done with once it is replaced, like when its popup got closed
+    m_retainedImages.remove(previous);
+
+    // it was waiting to replace another one itself, this one takes its place
+    for (TagSuccessor &successor : m_tagSuccessors) {
+        if (successor.notification == previous) {
+            successor.notification = notification;
+            successor.config = config;
+            finish(previous);
+            return true;
+        }
+    }
+
+    if (const uint id = notificationId(previous)) {
+        // activating the notification on the server activates this one from now on
+        insertNotification(id, notification);
+        finish(previous);
+        // it replaces the one on the server, but is new otherwise: if that fails, this one is done with
+        if (!sendNotificationToServer(notification, config)) {
+            finish(notification);
+        }
+        return true;
+    }
+
+    const bool queued = m_dispatchQueue.removeIf([previous](const PendingNotify &pending) {
+        return pending.notification == previous;
+    }) > 0;
+    const bool imagePending = removePendingImage(previous);
+    if (queued || imagePending) {
+        // not on the server yet, this one goes there instead
+        finish(previous);
+        return false;
+    }
+
+    // otherwise it is replaced once the server told the id, see processDispatchBatch()
+    m_tagSuccessors.insert(previous, TagSuccessor{notification, config});
+    return true;
+}
+
+bool NotifyByPopup::sendTagSuccessor(KNotification *notification, uint id)
+{
+    const auto it = m_tagSuccessors.find(notification);
+    if (it == m_tagSuccessors.end()) {
+        return false;
+    }
+
+    const TagSuccessor successor = *it;
+    m_tagSuccessors.erase(it);
+    if (!successor.notification) {
+        return false;
+    }
+
+    if (id != 0) {
+        insertNotification(id, successor.notification);
+    }
+    if (!sendNotificationToServer(successor.notification, successor.config)) {
+        finish(successor.notification);
+    }
+    return true;
+}
+
+bool NotifyByPopup::joinAggregate(KNotification *notification, const KNotifyConfig &config)
+{
+    bool ok = false;
+    const qint64 window = eventOrGlobalEntry(config, QStringLiteral("AggregationWindow")).toLongLong(&ok);
+    // a re-emitted notification is in one already, tagged ones replace each other rather than adding up
+    if (!ok || window <= 0 || m_aggregates.contains(notification) || !notification->tag().isEmpty()) {
+        return false;
+    }
+
+    const qint64 now = m_clock.elapsed();
+    std::shared_ptr<Aggregate> &open = m_openAggregates[{notification->appName(), notification->eventId()}];
+
+    if (!open || !open->carrier || now - open->lastAdded > window) {
+        // a new burst, the previous one stays on the server as it is
+        open = std::make_shared<Aggregate>(Aggregate{{}, notification, config, now});
+    }
+
+    const std::shared_ptr<Aggregate> aggregate = open;
+    aggregate->members.append(notification);
+    aggregate->config = config;
+    aggregate->lastAdded = now;
+    m_aggregates.insert(notification, aggregate);
+
+    if (aggregate->carrier == notification) {
+        // shown on its own, until others join
+        return false;
+    }
+
+    handOverAggregate(aggregate);
+    return true;
+}
+
+void NotifyByPopup::handOverAggregate(const std::shared_ptr<Aggregate> &aggregate)
+{
+    aggregate->members.removeIf([](const QPointer<KNotification> &member) {
+        return !member;
+    });
+    if (aggregate->members.isEmpty()) {
+        return;
+    }
+
+    KNotification *newest = aggregate->members.constLast();
+    KNotification *carrier = aggregate->carrier;
+
+    if (carrier == newest) {
+        sendNotificationToServer(newest, aggregate->config, true);
+        return;
+    }
+
+    if (const uint id = carrier ? notificationId(carrier) : 0) {
+        // activating the notification on the server activates the newest one from now on
+        insertNotification(id, newest);
+        aggregate->carrier = newest;
+        sendNotificationToServer(newest, aggregate->config, true);
+        return;
+    }
+
+    const bool queued = carrier && m_dispatchQueue.removeIf([carrier](const PendingNotify &pending) {
+        return pending.notification == carrier;
+    }) > 0;
+    if (!carrier || queued) {
+        // not on the server yet, the newest one goes there instead
+        aggregate->carrier = newest;
+        if (!sendNotificationToServer(newest, aggregate->config)) {
+            // none of them will be shown then
+            const QList<QPointer<KNotification>> members = takeAggregate(newest);
+            for (KNotification *member : members) {
+                if (member) {
+                    finish(member);
+                }
+            }
+        }
+    }
+
+    // otherwise it is handed over once the server told the id, see processDispatchBatch()
+}
+
+bool NotifyByPopup::leaveAggregate(KNotification *notification)
+{
+    const std::shared_ptr<Aggregate> aggregate = m_aggregates.take(notification);
+    if (!aggregate) {
+        return false;
+    }
+
+    aggregate->members.removeIf([notification](const QPointer<KNotification> &member) {
+        return !member || member == notification;
+    });
+    if (aggregate->members.isEmpty()) {
+        m_openAggregates.removeIf([&aggregate](const auto &it) {
+            return it.value() == aggregate;
+        });
+        return false;
+    }
+
+    handOverAggregate(aggregate);
+    return true;
+}
+
+QList<QPointer<KNotification>> NotifyByPopup::takeAggregate(KNotification *notification)
+{
+    const std::shared_ptr<Aggregate> aggregate = m_aggregates.value(notification);
+    if (!aggregate) {
+        return {};
+    }
+
+    m_aggregates.removeIf([&aggregate](const auto &it) {
+        return it.value() == aggregate;
+    });
+    m_openAggregates.removeIf([&aggregate](const auto &it) {
+        return it.value() == aggregate;
+    });
+    return aggregate->members;
+}
+
+bool NotifyByPopup::aggregateTexts(const Aggregate &aggregate, QString *title, QString *text) const
+{
+    QStringList lines;
+    int count = 0;
+    // newest first
+    for (auto it = aggregate.members.crbegin(); it != aggregate.members.crend(); ++it) {
+        const KNotification *member = it->data();
+        if (!member) {
+            continue;
+        }
+        ++count;
+        if (lines.size() < s_aggregateLines) {
+            lines.append(member->title().isEmpty() ? RichText::toPlainText(member->text()) : member->title());
+        }
+    }
+
+    if (count < 2) {
+        return false;
+    }
+
+    *title = tr("%n new notification(s)", "Several notifications of the same event shown as one", count);
+    *text = lines.join(QLatin1Char('\n'));
+    return true;
+}
+
 void NotifyByPopup::getAppCaptionAndIconName(const KNotifyConfig &notifyConfig, QString *appCaption, QString *iconName)
 {
     *appCaption = notifyConfig.readGlobalEntry(QStringLiteral("Name"));
@@ -167,10 +695,7 @@ void NotifyByPopup::getAppCaptionAndIconName(const KNotifyConfig &notifyConfig,
         *appCaption = notifyConfig.applicationName();
     }
 
-    *iconName = notifyConfig.readEntry(QStringLiteral("IconName"));
-    if (iconName->isEmpty()) {
-        *iconName = notifyConfig.readGlobalEntry(QStringLiteral("IconName"));
-    }
+    *iconName = eventOrGlobalEntry(notifyConfig, QStringLiteral("IconName"));
     if (iconName->isEmpty()) {
         *iconName = qGuiApp->windowIcon().name();
     }
@@ -181,9 +706,22 @@ void NotifyByPopup::getAppCaptionAndIconName(const KNotifyConfig &notifyConfig,
 
 bool NotifyByPopup::sendNotificationToServer(KNotification *notification, const KNotifyConfig &notifyConfig_nocheck, bool update)
 {
-    uint updateId = m_notifications.key(notification, 0);
+    uint updateId = notificationId(notification);
 
-    if (update) {
+    // not sent yet, the queued call will be replaced with the current state, see queueNotify()
+    const bool queued = std::any_of(m_dispatchQueue.cbegin(), m_dispatchQueue.cend(), [notification](const PendingNotify &pending) {
+        return pending.notification == notification;
+    });
+
+    // the image of an older state is still being converted, the current state supersedes it
+    bool imagePending = false;
+    if (auto pendingIt = m_pendingImages.constFind(notification); pendingIt != m_pendingImages.constEnd()) {
+        imagePending = true;
+        update = update && pendingIt->update;
+        removePendingImage(notification);
+    }
+
+    if (update && !queued && !imagePending) {
         if (updateId == 0) {
             // we have nothing to update; the notification we're trying to update
             // has been already closed
@@ -200,11 +738,29 @@ bool NotifyByPopup::sendNotificationToServer(KNotification *notification, const
         iconName = notification->iconName();
     }
 
+    // whole log files end up in notifications, there is no point in marshalling more than a popup can show
+    const qsizetype maxTitleLength = lengthEntry(notifyConfig_nocheck, QStringLiteral("MaxTitleLength"), s_defaultMaxTitleLength);
+    const qsizetype maxBodyLength = lengthEntry(notifyConfig_nocheck, QStringLiteral("MaxBodyLength"), s_defaultMaxBodyLength);
+
     QString title = notification->title().isEmpty() ? appCaption : notification->title();
     QString text = notification->text();
 
-    if (!m_popupServerCapabilities.contains(QLatin1String("body-markup"))) {
-        text = stripRichText(text);
+    const std::shared_ptr<Aggregate> aggregate = m_aggregates.value(notification);
+    const bool aggregated = aggregate && aggregate->carrier == notification && aggregateTexts(*aggregate, &title, &text);
+
+    title = RichText::elided(title, maxTitleLength);
+
+    if (aggregated) {
+        text = RichText::elided(text, maxBodyLength);
+        if (m_popupServerCapabilities.contains(QLatin1String("body-markup"))) {
+            text = text.toHtmlEscaped();
+        }
+    } else if (!m_popupServerCapabilities.contains(QLatin1String("body-markup"))) {
+        text = RichText::toPlainText(text, maxBodyLength);
+    } else if (boolEntry(notifyConfig_nocheck, QStringLiteral("NormalizeMarkup")) || (maxBodyLength > 0 && text.size() > maxBodyLength)) {
+        // otherwise the server gets to sanitize whatever the application sent; markup that may be
+        // too long is normalized in any case, as cutting it as is could leave broken tags behind
+        text = RichText::normalizedMarkup(text, maxBodyLength);
     }
 
     QVariantMap hintsMap;
@@ -301,37 +857,308 @@ bool NotifyByPopup::sendNotificationToServer(KNotification *notification, const
     }
 
     // let's see if we've got an image, and store the image in the hints map
-    if (!notification->pixmap().isNull()) {
-        hintsMap[QStringLiteral("image_data")] = ImageConverter::variantForImage(notification->pixmap().toImage());
+    bool needsConversion = false;
+    ImageKey imageKey;
+    notification->d->convertPixmap();
+    if (const qint64 cacheKey = notification->d->imageKey) {
+        imageKey = ImageKey{cacheKey, ImageConverter::maxImageSize(notifyConfig_nocheck)};
+        if (const ImageHint *hint = cachedImageHint(imageKey)) {
+            hintsMap[hint->name] = hint->value;
+            retainImage(notification, imageKey, hint->hash);
+        } else if (const QString path = retainedImagePath(notification, imageKey); !path.isEmpty()) {
+            hintsMap[QStringLiteral("image-path")] = path;
+        } else if (!notification->image().isNull() || m_imageConversions.contains(imageKey)) {
+            needsConversion = true;
+        } else {
+            qCDebug(LOG_KNOTIFICATIONS) << "The image of notification" << notification->id() << "was released and is not stored, it is sent without it";
+        }
     }
 
     // Persistent     => 0  == infinite timeout
     // CloseOnTimeout => -1 == let the server decide
     int timeout = (notification->flags() & KNotification::Persistent) ? 0 : -1;
 
-    const QDBusPendingReply<uint> reply = m_dbusInterface.Notify(appCaption, updateId, iconName, title, text, actionList, hintsMap, timeout);
+    // same argument list as org::freedesktop::Notifications::Notify()
+    QVariantList arguments{QVariant::fromValue(appCaption),
+                           QVariant::fromValue(updateId),
+                           QVariant::fromValue(iconName),
+                           QVariant::fromValue(title),
+                           QVariant::fromValue(text),
+                           QVariant::fromValue(actionList),
+                           QVariant::fromValue(hintsMap),
+                           QVariant::fromValue(timeout)};
 
-    // parent is set to the notification so that no-one ever accesses a dangling pointer on the notificationObject property
-    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(reply, notification);
+    if (needsConversion) {
+        // converting images takes a while, don't let the notifications without one wait for that
+        convertImage(notification, imageKey, std::move(arguments), update);
+        return true;
+    }
+
+    // after the notifications whose images are being converted right now
+    queueNotify(notification, std::move(arguments), update, m_imageSequence + 1);
+    return true;
+}
+
+void NotifyByPopup::queueNotify(KNotification *notification, QVariantList &&arguments, bool update, quint64 ticket)
+{
+    auto queuedIt = std::find_if(m_dispatchQueue.begin(), m_dispatchQueue.end(), [notification](const PendingNotify &pending) {
+        return pending.notification == notification;
+    });
+
+    if (queuedIt != m_dispatchQueue.end()) {
+        queuedIt->arguments = std::move(arguments);
+        return;
+    }
+
+    // an image that took less time to convert than an earlier one goes before the calls waiting for that
+    const QString appName = notification->appName();
+    auto laterIt = std::find_if(m_dispatchQueue.begin(), m_dispatchQueue.end(), [&appName, ticket](const PendingNotify &pending) {
+        return pending.ticket > ticket && pending.notification && pending.notification->appName() == appName;
+    });
+    m_dispatchQueue.insert(laterIt, PendingNotify{notification, std::move(arguments), update, ticket});
+
+    if (!m_dispatchTimer.isActive()) {
+        m_dispatchTimer.start();
+    }
+}
+
+bool NotifyByPopup::waitsForImage(const PendingNotify &pending) const
+{
+    const QString appName = pending.notification->appName();
+    return std::any_of(m_pendingImages.cbegin(), m_pendingImages.cend(), [&appName, &pending](const PendingImage &image) {
+        return image.sequence < pending.ticket && image.appName == appName;
+    });
+}
+
+void NotifyByPopup::flushDispatchQueue()
+{
+    m_dispatchTimer.stop();
+
+    if (m_dispatchQueue.isEmpty()) {
+        return;
+    }
+
+    auto batch = std::make_shared<DispatchBatch>();
+    batch->reserve(m_dispatchQueue.size());
+
+    const QList<PendingNotify> queue = std::exchange(m_dispatchQueue, {});
+    for (const PendingNotify &pending : queue) {
+        if (!pending.notification) {
+            continue;
+        }
+
+        // sent once that image is converted, see removePendingImage()
+        if (waitsForImage(pending)) {
+            m_dispatchQueue.append(pending);
+            continue;
+        }
 
-    QObject::connect(watcher, &QDBusPendingCallWatcher::finished, this, [this, notification](QDBusPendingCallWatcher *watcher) {
+        // the calls are only queued on the connection here, the reply of each one is picked up in processDispatchBatch()
+        batch->append(DispatchedNotify{pending.notification, m_dbusInterface.asyncCallWithArgumentList(QStringLiteral("Notify"), pending.arguments), pending.update});
+    }
+
+    if (!batch->isEmpty()) {
+        // replies come in order, so once the last one is there, the others usually are as well
+        watchDispatchBatch(batch, batch->constLast().call);
+    }
+}
+
+void NotifyByPopup::watchDispatchBatch(const std::shared_ptr<DispatchBatch> &batch, const QDBusPendingCall &call)
+{
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(call, this);
+
+    QObject::connect(watcher, &QDBusPendingCallWatcher::finished, this, [this, batch](QDBusPendingCallWatcher *watcher) {
         watcher->deleteLater();
-        if (!watcher->isError()) {
-            QDBusPendingReply<uint> reply = *watcher;
-            m_notifications.insert(reply.argumentAt<0>(), notification);
+        processDispatchBatch(batch);
+    });
+}
+
+void NotifyByPopup::processDispatchBatch(const std::shared_ptr<DispatchBatch> &batch)
+{
+    auto remaining = std::make_shared<DispatchBatch>();
+
+    for (const DispatchedNotify &dispatched : std::as_const(*batch)) {
+        // keep the order: once a reply is missing, everything after it has to wait as well
+        if (!remaining->isEmpty() || !dispatched.call.isFinished()) {
+            remaining->append(dispatched);
+            continue;
+        }
+
+        if (!dispatched.notification) {
+            continue;
+        }
+
+        const QDBusPendingReply<uint> reply = dispatched.call;
+        const std::shared_ptr<Aggregate> aggregate = m_aggregates.value(dispatched.notification);
+        if (aggregate && aggregate->carrier != dispatched.notification) {
+            // the notification on the server was handed over to a newer one of its burst since
+            continue;
+        }
+
+        if (!reply.isError()) {
+            const uint id = reply.argumentAt<0>();
+            insertNotification(id, dispatched.notification);
+            // more notifications joined it while the call was on the way
+            if (aggregate && aggregate->members.constLast() != dispatched.notification) {
+                handOverAggregate(aggregate);
+            }
+            // or a newer one with the same tag came in
+            if (sendTagSuccessor(dispatched.notification, id)) {
+                m_retainedImages.remove(dispatched.notification);
+                finish(dispatched.notification);
+            }
         } else {
-            qCWarning(LOG_KNOTIFICATIONS) << "Failed to notify" << watcher->error().message();
+            qCWarning(LOG_KNOTIFICATIONS) << "Failed to notify" << dispatched.notification->id() << reply.error().message();
+            // the server won't ever tell us that this one got closed
+            if (!dispatched.update) {
+                // nor about the others that were to be shown along with it
+                const QList<QPointer<KNotification>> aggregated = takeAggregate(dispatched.notification);
+                for (KNotification *other : aggregated) {
+                    if (other && other != dispatched.notification) {
+                        finish(other);
+                    }
+                }
+                // it was to replace the one of a notification done with already, which is of no use anymore
+                if (const uint id = notificationId(dispatched.notification)) {
+                    removeNotification(id, dispatched.notification);
+                    m_dbusInterface.CloseNotification(id);
+                }
+                sendTagSuccessor(dispatched.notification, 0);
+                finish(dispatched.notification);
+            }
+        }
+    }
+
+    if (!remaining->isEmpty()) {
+        // the first remaining call is the one we are still waiting for
+        watchDispatchBatch(remaining, remaining->constFirst().call);
+    }
+}
+
+void NotifyByPopup::onServiceOwnerChanged(const QString &serviceName, const QString &oldOwner, const QString &newOwner)
+{
+    Q_UNUSED(serviceName);
+    Q_UNUSED(oldOwner);
+
+    if (!newOwner.isEmpty()) {
+        refreshServerCapabilities();
+    }
+}
+
+/*
+ * Capabilities that change how notifications are encoded, which a server that doesn't
+ * have them shows wrongly, rather than just what they may carry
+ */
+static bool isEncodingCapability(const QString &capability)
+{
+    return capability == QLatin1String("body-markup") || capability == QLatin1String("x-kde-image-fd")
+        || capability == QLatin1String("inline-reply");
+}
+
+/*
+ * Where the server information and capabilities are kept between runs
+ */
+static QString serverCapabilitiesFileName()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + QLatin1String("/knotifications6/notificationserver");
+}
+
+void NotifyByPopup::loadServerCapabilities()
+{
+    QFile file(serverCapabilitiesFileName());
+    if (!file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+
+    // the server name and version, then one capability per line
+    QStringList lines = QString::fromUtf8(file.readAll()).split(QLatin1Char('\n'));
+    if (lines.size() < 2 || lines.constFirst().isEmpty()) {
+        return;
+    }
+
+    m_serverName = lines.takeFirst();
+    m_serverVersion = lines.takeFirst();
+    lines.removeAll(QString());
+
+    // another server may have taken over since, until it turns out to be the same one the
+    // notifications are only encoded the way every server understands, see refreshServerCapabilities()
+    m_unconfirmedServerCapabilities = lines;
+    lines.removeIf(isEncodingCapability);
+    m_popupServerCapabilities = lines;
+    m_dbusServiceCapCacheDirty = false;
+}
+
+void NotifyByPopup::storeServerCapabilities() const
+{
+    QString contents = m_serverName + QLatin1Char('\n') + m_serverVersion + QLatin1Char('\n');
+    for (const QString &capability : m_popupServerCapabilities) {
+        contents += capability + QLatin1Char('\n');
+    }
+
+    QThreadPool::globalInstance()->start([fileName = serverCapabilitiesFileName(), contents] {
+        QDir().mkpath(QFileInfo(fileName).path());
+
+        // written atomically, other processes may be reading it at any time
+        QSaveFile file(fileName);
+        if (!file.open(QIODevice::WriteOnly) || file.write(contents.toUtf8()) < 0 || !file.commit()) {
+            qCDebug(LOG_KNOTIFICATIONS) << "Failed to store notification server capabilities" << fileName << file.errorString();
         }
     });
+}
 
-    return true;
+void NotifyByPopup::refreshServerCapabilities()
+{
+    // whatever was not stored yet belongs to the server before
+    m_capabilitiesUnstored = false;
+
+    if (m_dbusServiceCapCacheDirty) {
+        // notifications are waiting for them, so don't wait for the server information first
+        queryPopupServerCapabilities();
+    }
+
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(m_dbusInterface.GetServerInformation(), this);
+
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [this](QDBusPendingCallWatcher *watcher) {
+        watcher->deleteLater();
+        const QDBusPendingReply<QString, QString, QString, QString> reply = *watcher;
+        if (reply.isError()) {
+            qCDebug(LOG_KNOTIFICATIONS) << "Failed to get notification server information" << reply.error().message();
+            return;
+        }
+
+        const QString name = reply.argumentAt<0>();
+        const QString version = reply.argumentAt<2>();
+        if (!m_dbusServiceCapCacheDirty && name == m_serverName && version == m_serverVersion) {
+            // the capabilities we have are the ones of this server
+            if (!m_unconfirmedServerCapabilities.isEmpty()) {
+                m_popupServerCapabilities = std::exchange(m_unconfirmedServerCapabilities, {});
+            }
+            return;
+        }
+        m_unconfirmedServerCapabilities.clear();
+
+        if (m_capabilitiesUnstored) {
+            // queried right away as notifications were waiting for them, they belong to this server
+            m_capabilitiesUnstored = false;
+            m_serverName = name;
+            m_serverVersion = version;
+            storeServerCapabilities();
+            return;
+        }
+
+        // the capabilities that arrive next are stored for this server
+        m_pendingServerName = name;
+        m_pendingServerVersion = version;
+        queryPopupServerCapabilities();
+    });
 }
 
 void NotifyByPopup::queryPopupServerCapabilities()
 {
-    if (!m_dbusServiceCapCacheDirty) {
+    if (m_capabilitiesQueryPending) {
         return;
     }
+    m_capabilitiesQueryPending = true;
 
     QDBusPendingReply<QStringList> call = m_dbusInterface.GetCapabilities();
 
@@ -339,11 +1166,22 @@ void NotifyByPopup::queryPopupServerCapabilities()
 
     QObject::connect(watcher, &QDBusPendingCallWatcher::finished, this, [this](QDBusPendingCallWatcher *watcher) {
         watcher->deleteLater();
+        m_capabilitiesQueryPending = false;
         const QDBusPendingReply<QStringList> reply = *watcher;
         const QStringList capabilities = reply.argumentAt<0>();
         m_popupServerCapabilities = capabilities;
+        m_unconfirmedServerCapabilities.clear();
         m_dbusServiceCapCacheDirty = false;
 
+        if (!reply.isError() && !m_pendingServerName.isEmpty()) {
+            m_serverName = std::exchange(m_pendingServerName, QString());
+            m_serverVersion = std::exchange(m_pendingServerVersion, QString());
+            storeServerCapabilities();
+        } else if (!reply.isError()) {
+            // the server information is still on its way, see refreshServerCapabilities()
+            m_capabilitiesUnstored = true;
+        }
+
         // re-run notify() on all enqueued m_notifications
         for (const QPair<KNotification *, KNotifyConfig> &noti : std::as_const(m_notificationQueue)) {
             notify(noti.first, noti.second);
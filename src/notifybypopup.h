@@ -9,17 +9,27 @@
 #ifndef NOTIFYBYPOPUP_H
 #define NOTIFYBYPOPUP_H
 
+#include "imagestore.h"
 #include "knotificationplugin.h"
 
+#include "knotifications_export.h"
 #include "knotifyconfig.h"
+#include <QCache>
+#include <QDBusPendingCall>
+#include <QElapsedTimer>
+#include <QFuture>
+#include <QPointer>
 #include <QStringList>
+#include <QTimer>
 
 #include "notifications_interface.h"
 
+#include <memory>
+
 class KNotification;
 class QDBusPendingCallWatcher;
 
-class NotifyByPopup : public KNotificationPlugin
+class KNOTIFICATIONS_TESTS_EXPORT NotifyByPopup : public KNotificationPlugin
 {
     Q_OBJECT
 public:
@@ -33,6 +43,8 @@ public:
     void notify(KNotification *notification, const KNotifyConfig &notifyConfig) override;
     void close(KNotification *notification) override;
     void update(KNotification *notification, const KNotifyConfig &notifyConfig) override;
+    void replace(KNotification *previous, KNotification *notification, const KNotifyConfig &notifyConfig) override;
+    bool needsImage(KNotification *notification) const override;
 
 private Q_SLOTS:
     // slot which gets called when DBus signals that some notification action was invoked
@@ -41,6 +53,7 @@ private Q_SLOTS:
     // slot which gets called when DBus signals that some notification was closed
     void onNotificationClosed(uint, uint);
     void onNotificationReplied(uint notificationId, const QString &text);
+    void onServiceOwnerChanged(const QString &serviceName, const QString &oldOwner, const QString &newOwner);
 
 private:
     /*
@@ -54,6 +67,153 @@ private:
      */
     bool sendNotificationToServer(KNotification *notification, const KNotifyConfig &config, bool update = false);
 
+    /*
+     * Sends all Notify calls queued by sendNotificationToServer() in this event loop
+     * iteration in one go, and tracks their replies together.
+     *
+     * Calls that have to wait for the image of an earlier notification of their
+     * application stay in the queue, see waitsForImage().
+     */
+    void flushDispatchQueue();
+
+    struct DispatchedNotify {
+        QPointer<KNotification> notification;
+        QDBusPendingCall call;
+        bool update;
+    };
+    using DispatchBatch = QList<DispatchedNotify>;
+
+    /*
+     * Waits for call to finish, then processes the replies of the batch of Notify calls
+     * sent by flushDispatchQueue() in the order the calls were made.
+     */
+    void watchDispatchBatch(const std::shared_ptr<DispatchBatch> &batch, const QDBusPendingCall &call);
+    void processDispatchBatch(const std::shared_ptr<DispatchBatch> &batch);
+
+    /*
+     * Queues a Notify call to be sent by flushDispatchQueue(), replacing
+     * the one already queued for notification if any
+     *
+     * The call is sent after those of the notifications of the same application whose
+     * image conversion started before ticket, even if their images take longer.
+     */
+    void queueNotify(KNotification *notification, QVariantList &&arguments, bool update, quint64 ticket);
+
+    struct ImageHint {
+        QString name;
+        QVariant value;
+        // see ImageStore
+        QByteArray hash;
+        // memory used by value, in bytes
+        qsizetype cost = 0;
+    };
+    // QImage::cacheKey() and maximum size
+    using ImageKey = std::pair<qint64, int>;
+
+    /*
+     * Whether the server takes images as x-kde-image-fd hints
+     */
+    bool passImageFd() const;
+
+    /*
+     * Returns the hint for an image that was converted before, e.g. for a previous
+     * update of the notification, or nullptr if it needs to be converted
+     */
+    const ImageHint *cachedImageHint(const ImageKey &key);
+
+    /*
+     * Returns the path of the released image of notification in the ImageStore,
+     * or an empty string if it is not stored, see retainImage()
+     */
+    QString retainedImagePath(KNotification *notification, const ImageKey &key) const;
+
+    /*
+     * Keeps the hash of the image of notification for as long as notification is around,
+     * if it releases its image after delivery, so that updates can still show the stored image
+     */
+    void retainImage(KNotification *notification, const ImageKey &key, const QByteArray &hash);
+
+    /*
+     * Converts the image of notification in a worker thread, then adds it to the
+     * Notify call with the given arguments and queues that
+     *
+     * If the same image is being converted already, this waits for that instead.
+     */
+    void convertImage(KNotification *notification, const ImageKey &key, QVariantList &&arguments, bool update);
+
+    /*
+     * Returns the hint for image scaled down to maxSize, this is thread-safe
+     *
+     * That is image-path if the same pixels were sent before and got stored,
+     * x-kde-image-fd if passFd is set, or else image_data.
+     */
+    static ImageHint imageHint(const QImage &image, int maxSize, bool passFd, ImageStore *store);
+
+    /*
+     * Drops the image conversion of notification if there is one, the calls
+     * waiting for it may go out then, returns whether there was one
+     */
+    bool removePendingImage(KNotification *notification);
+
+    /*
+     * Returns the server-side id of notification, or 0 if it is not on the server
+     */
+    uint notificationId(KNotification *notification) const;
+    void insertNotification(uint id, KNotification *notification);
+    void removeNotification(uint id, KNotification *notification);
+
+    /*
+     * Notifications of an event with an AggregationWindow that came in a burst, shown
+     * as one notification on the server, which belongs to the newest of them
+     */
+    struct Aggregate {
+        // oldest first
+        QList<QPointer<KNotification>> members;
+        // the member the notification on the server belongs to, see handOverAggregate()
+        QPointer<KNotification> carrier;
+        KNotifyConfig config;
+        // when the last member was added, see m_clock
+        qint64 lastAdded = 0;
+    };
+
+    /*
+     * Adds notification to the burst of its event if there is one, returns whether it
+     * is shown along with others rather than on its own
+     */
+    bool joinAggregate(KNotification *notification, const KNotifyConfig &config);
+
+    /*
+     * Shows the current state of aggregate, handing the notification on the server over to its newest member
+     */
+    void handOverAggregate(const std::shared_ptr<Aggregate> &aggregate);
+
+    /*
+     * Removes notification from its aggregate, returns whether the others are still shown
+     */
+    bool leaveAggregate(KNotification *notification);
+
+    /*
+     * Dissolves the aggregate of notification, returning its members
+     */
+    QList<QPointer<KNotification>> takeAggregate(KNotification *notification);
+
+    /*
+     * Sets the title and text listing the members of aggregate, unless there is only one
+     */
+    bool aggregateTexts(const Aggregate &aggregate, QString *title, QString *text) const;
+
+    /*
+     * Shows notification in place of the one it replaces if there is one, see replace(),
+     * returns whether it is taken care of that way rather than to be sent as a new one
+     */
+    bool replaceTagged(KNotification *notification, const KNotifyConfig &config);
+
+    /*
+     * Sends the notification waiting to replace notification, in its place on the server
+     * if id is not 0 or else as a new one, returns whether there was one
+     */
+    bool sendTagSuccessor(KNotification *notification, uint id);
+
     /*
      * Find the caption and the icon name of the application
      */
@@ -63,10 +223,34 @@ private:
      */
     void queryPopupServerCapabilities();
 
+    /*
+     * Asks the server who it is in the background, and for its capabilities
+     * if they are not the ones known for it
+     */
+    void refreshServerCapabilities();
+
+    /*
+     * Reads and writes the capabilities of the server the last time, so that new
+     * processes don't need to wait for them before sending their first notification
+     */
+    void loadServerCapabilities();
+    void storeServerCapabilities() const;
+
     /*
      * DBus notification daemon capabilities cache.
      */
     QStringList m_popupServerCapabilities;
+    // the stored capabilities, until the server is known to be the one they belong to
+    QStringList m_unconfirmedServerCapabilities;
+    // name and version of the server the capabilities belong to, if known
+    QString m_serverName;
+    QString m_serverVersion;
+    // the same for the server whose capabilities are being queried
+    QString m_pendingServerName;
+    QString m_pendingServerVersion;
+    bool m_capabilitiesQueryPending = false;
+    // the capabilities arrived before the server information, they are stored along with that
+    bool m_capabilitiesUnstored = false;
 
     /*!
      * In case we still don't know notification server capabilities,
@@ -75,6 +259,24 @@ private:
      * to return, then process them from this queue
      */
     QList<QPair<KNotification *, KNotifyConfig>> m_notificationQueue;
+    /*
+     * Notify calls waiting to be sent by flushDispatchQueue().
+     */
+    struct PendingNotify {
+        QPointer<KNotification> notification;
+        QVariantList arguments;
+        bool update;
+        // see queueNotify()
+        quint64 ticket;
+    };
+    QList<PendingNotify> m_dispatchQueue;
+
+    /*
+     * Whether pending has to wait for the image of an earlier notification of its application
+     */
+    bool waitsForImage(const PendingNotify &pending) const;
+    QTimer m_dispatchTimer;
+
     /*
      * Whether the DBus notification daemon capability cache is up-to-date.
      */
@@ -85,9 +287,65 @@ private:
      * we use only ids, this is for fast KNotifications lookup
      */
     QHash<uint, QPointer<KNotification>> m_notifications;
+    // the other way round, see notificationId()
+    QHash<KNotification *, uint> m_notificationIds;
+
+    /*
+     * Converted image hints by QImage::cacheKey() and maximum size,
+     * with their size in bytes as cost, except for x-kde-image-fd ones
+     */
+    QCache<ImageKey, ImageHint> m_imageHintCache;
+    // shared with the conversions running in worker threads
+    std::shared_ptr<ImageStore> m_imageStore;
+    // the conversions running in worker threads, by what they convert
+    QHash<ImageKey, QFuture<ImageHint>> m_imageConversions;
+
+    /*
+     * Image hashes of notifications with ReleaseImageAfterDelivery, by which updates
+     * find the stored image without the pixels being around, see retainImage()
+     */
+    struct RetainedImage {
+        QPointer<KNotification> notification;
+        ImageKey key;
+        QByteArray hash;
+    };
+    QHash<KNotification *, RetainedImage> m_retainedImages;
+
+    /*
+     * Notifications whose image is being converted by convertImage(), a newer state
+     * of the notification supersedes the conversion by removing it from here
+     */
+    struct PendingImage {
+        quint64 sequence;
+        bool update;
+        QString appName;
+    };
+    QHash<KNotification *, PendingImage> m_pendingImages;
+    quint64 m_imageSequence = 0;
+
+    // the aggregates new notifications of an event join, by application name and event id
+    QHash<std::pair<QString, QString>, std::shared_ptr<Aggregate>> m_openAggregates;
+    // the aggregate of each notification, for events with an AggregationWindow
+    QHash<KNotification *, std::shared_ptr<Aggregate>> m_aggregates;
+    QElapsedTimer m_clock;
+
+    // the notifications each notification replaces, until notify() gets to them, see replace()
+    QHash<KNotification *, QPointer<KNotification>> m_replacedNotifications;
+    /*
+     * Notifications replacing one with the same tag whose Notify call is still on the way,
+     * by that one, they are sent once the server told its id
+     */
+    struct TagSuccessor {
+        QPointer<KNotification> notification;
+        KNotifyConfig config;
+    };
+    QHash<KNotification *, TagSuccessor> m_tagSuccessors;
 
     org::freedesktop::Notifications m_dbusInterface;
 
+    friend class KNotificationBenchmark;
+    friend class KNotificationTest;
+
     Q_DISABLE_COPY_MOVE(NotifyByPopup)
 };
 
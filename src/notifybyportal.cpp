@@ -10,23 +10,35 @@
 #include "notifybyportal.h"
 
 #include "debug_p.h"
+#include "imageconverter.h"
 #include "knotification.h"
+#include "knotification_p.h"
 #include "knotifyconfig.h"
 
 #include <QBuffer>
+#include <QCache>
 #include <QDBusConnection>
 #include <QDBusConnectionInterface>
 #include <QDBusError>
 #include <QDBusMessage>
 #include <QDBusMetaType>
+#include <QDBusPendingCallWatcher>
+#include <QDBusPendingReply>
 #include <QDBusServiceWatcher>
+#include <QFuture>
 #include <QGuiApplication>
 #include <QHash>
 #include <QIcon>
 #include <QMap>
 #include <QPointer>
+#include <QPromise>
+#include <QSet>
+#include <QThreadPool>
 
 #include <KConfigGroup>
+
+#include <utility>
+
 static const char portalDbusServiceName[] = "org.freedesktop.portal.Desktop";
 static const char portalDbusInterfaceName[] = "org.freedesktop.portal.Notification";
 static const char portalDbusPath[] = "/org/freedesktop/portal/desktop";
@@ -41,6 +53,7 @@ public:
 
     NotifyByPortalPrivate(NotifyByPortal *parent)
         : dbusServiceExists(false)
+        , iconCache(4 * 1024 * 1024)
         , q(parent)
     {
     }
@@ -52,9 +65,15 @@ public:
      * update If true, will request the DBus service to update
                      the notification with new data from \c notification
      *               Otherwise will put new notification on screen
+     * previous If set, the notification shown that this one replaces
      * Returns true for success or false if there was an error.
      */
-    bool sendNotificationToPortal(KNotification *notification, const KNotifyConfig &config);
+    bool sendNotificationToPortal(KNotification *notification, const KNotifyConfig &config, KNotification *previous = nullptr);
+
+    /*
+     * Sends the AddNotification call for the notification with the given portal-side id
+     */
+    void addPortalNotification(uint id, const QVariantMap &portalArgs);
 
     /*
      * Sends request to close Notification with id to DBus "org.freedesktop.notifications" interface
@@ -77,6 +96,24 @@ public:
      * we use only ids, this is for fast KNotifications lookup
      */
     QHash<uint, QPointer<KNotification>> portalNotifications;
+    // the other way round, only valid if portalNotifications agrees, see portalNotificationId()
+    QHash<KNotification *, uint> portalNotificationIds;
+
+    /*
+     * Returns the portal-side id of notification, or 0 if it is not shown
+     */
+    uint portalNotificationId(KNotification *notification) const;
+
+    /*
+     * PNG encoded icons by QImage::cacheKey() and maximum size, with their size in bytes as cost
+     */
+    QCache<std::pair<qint64, int>, QByteArray> iconCache;
+
+    /*
+     * Notifications whose icon is still being encoded, they are sent once it is done
+     * unless they got closed in the meantime
+     */
+    QSet<uint> pendingIcons;
 
     /*
      * Holds the id that will be assigned to the next notification source
@@ -111,12 +148,20 @@ NotifyByPortal::NotifyByPortal(QObject *parent)
     : KNotificationPlugin(parent)
     , d(new NotifyByPortalPrivate(this))
 {
-    // check if service already exists on plugin instantiation
-    QDBusConnectionInterface *interface = QDBusConnection::sessionBus().interface();
-    d->dbusServiceExists = interface && interface->isServiceRegistered(QString::fromLatin1(portalDbusServiceName));
-
-    if (d->dbusServiceExists) {
-        onServiceOwnerChanged(QString::fromLatin1(portalDbusServiceName), QString(), QStringLiteral("_")); // connect signals
+    // KNotificationManager only creates this plugin once it knew the portal to be there, so assume it
+    // still is rather than blocking on the bus; a check in the background catches it being gone since
+    onServiceOwnerChanged(QString::fromLatin1(portalDbusServiceName), QString(), QStringLiteral("_")); // connect signals
+
+    if (QDBusConnectionInterface *interface = QDBusConnection::sessionBus().interface()) {
+        QDBusPendingCallWatcher *call =
+            new QDBusPendingCallWatcher(interface->asyncCall(QStringLiteral("NameHasOwner"), QString::fromLatin1(portalDbusServiceName)), this);
+        connect(call, &QDBusPendingCallWatcher::finished, this, [this](QDBusPendingCallWatcher *call) {
+            call->deleteLater();
+            const QDBusPendingReply<bool> reply = *call;
+            if (!reply.isError() && !reply.value() && d->dbusServiceExists) {
+                onServiceOwnerChanged(QString::fromLatin1(portalDbusServiceName), QStringLiteral("_"), QString());
+            }
+        });
     }
 
     // to catch register/unregister events from service in runtime
@@ -131,7 +176,7 @@ NotifyByPortal::~NotifyByPortal() = default;
 
 void NotifyByPortal::notify(KNotification *notification, const KNotifyConfig &notifyConfig)
 {
-    if (d->portalNotifications.contains(notification->id())) {
+    if (d->portalNotificationId(notification) != 0) {
         // notification is already on the screen, do nothing
         finish(notification);
         return;
@@ -152,6 +197,18 @@ void NotifyByPortal::close(KNotification *notification)
     }
 }
 
+void NotifyByPortal::replace(KNotification *previous, KNotification *notification, const KNotifyConfig &notifyConfig)
+{
+    if (!d->dbusServiceExists || d->portalNotificationId(notification) != 0) {
+        KNotificationPlugin::replace(previous, notification, notifyConfig);
+        return;
+    }
+
+    if (!d->sendNotificationToPortal(notification, notifyConfig, previous)) {
+        finish(notification); // an error occurred.
+    }
+}
+
 void NotifyByPortal::update(KNotification *notification, const KNotifyConfig &notifyConfig)
 {
     // TODO not supported by portals
@@ -170,6 +227,8 @@ void NotifyByPortal::onServiceOwnerChanged(const QString &serviceName, const QSt
     }
 
     d->portalNotifications.clear();
+    d->portalNotificationIds.clear();
+    d->pendingIcons.clear();
 
     if (newOwner.isEmpty()) {
         d->dbusServiceExists = false;
@@ -203,7 +262,11 @@ void NotifyByPortal::onPortalNotificationActionInvoked(const QString &id, const
     if (n) {
         Q_EMIT actionInvoked(n->id(), action);
     } else {
+        const uint portalId = iter.key();
         d->portalNotifications.erase(iter);
+        d->portalNotificationIds.removeIf([portalId](QHash<KNotification *, uint>::iterator it) {
+            return *it == portalId;
+        });
     }
 }
 
@@ -229,15 +292,8 @@ void NotifyByPortalPrivate::getAppCaptionAndIconName(const KNotifyConfig &notify
     }
 }
 
-bool NotifyByPortalPrivate::sendNotificationToPortal(KNotification *notification, const KNotifyConfig &notifyConfig_nocheck)
+bool NotifyByPortalPrivate::sendNotificationToPortal(KNotification *notification, const KNotifyConfig &notifyConfig_nocheck, KNotification *previous)
 {
-    QDBusMessage dbusNotificationMessage;
-    dbusNotificationMessage = QDBusMessage::createMethodCall(QString::fromLatin1(portalDbusServiceName),
-                                                             QString::fromLatin1(portalDbusPath),
-                                                             QString::fromLatin1(portalDbusInterfaceName),
-                                                             QStringLiteral("AddNotification"));
-
-    QVariantList args;
     // Will be used only with xdg-desktop-portal
     QVariantMap portalArgs;
 
@@ -298,43 +354,106 @@ bool NotifyByPortalPrivate::sendNotificationToPortal(KNotification *notification
     qDBusRegisterMetaType<QList<QVariantMap>>();
     qDBusRegisterMetaType<PortalIcon>();
 
-    if (!notification->pixmap().isNull()) {
-        QByteArray pixmapData;
-        QBuffer buffer(&pixmapData);
-        buffer.open(QIODevice::WriteOnly);
-        notification->pixmap().save(&buffer, "PNG");
-        buffer.close();
+    portalArgs.insert(QStringLiteral("title"), title);
+    portalArgs.insert(QStringLiteral("body"), text);
+    portalArgs.insert(QStringLiteral("buttons"), QVariant::fromValue<QList<QVariantMap>>(buttons));
 
+    // the portal replaces the notification with the same id, which this one takes over from the one it replaces
+    uint id = 0;
+    if (previous) {
+        id = portalNotificationId(previous);
+        if (pendingIcons.remove(id)) {
+            // never shown, the icon of this one may take longer
+            id = 0;
+        }
+        Q_EMIT q->finished(previous);
+    }
+
+    // If we are in sandbox we don't need to wait for returned notification id
+    if (id == 0) {
+        id = nextId++;
+    }
+    portalNotifications.insert(id, notification);
+    portalNotificationIds.insert(notification, id);
+
+    auto setIcon = [](QVariantMap &portalArgs, const QByteArray &pngData) {
         PortalIcon icon;
         icon.str = QStringLiteral("bytes");
-        icon.data.setVariant(pixmapData);
+        icon.data.setVariant(pngData);
         portalArgs.insert(QStringLiteral("icon"), QVariant::fromValue<PortalIcon>(icon));
-    } else {
+    };
+
+    const int maxImageSize = ImageConverter::maxImageSize(notifyConfig_nocheck);
+    notification->d->convertPixmap();
+    const std::pair<qint64, int> key{notification->d->imageKey, maxImageSize};
+    if (const QByteArray *pngData = key.first ? iconCache.object(key) : nullptr) {
+        setIcon(portalArgs, *pngData);
+        addPortalNotification(id, portalArgs);
+        return true;
+    }
+
+    // also if the image was released after being delivered, and the encoded one is gone too
+    const QImage image = notification->image();
+    if (image.isNull()) {
         // Use this for now for backwards compatibility, we can as well set the variant to be (sv) where the
         // string is keyword "themed" and the variant is an array of strings with icon names
         portalArgs.insert(QStringLiteral("icon"), iconName);
+        addPortalNotification(id, portalArgs);
+        return true;
     }
 
-    portalArgs.insert(QStringLiteral("title"), title);
-    portalArgs.insert(QStringLiteral("body"), text);
-    portalArgs.insert(QStringLiteral("buttons"), QVariant::fromValue<QList<QVariantMap>>(buttons));
+    // PNG compression takes long enough to drop frames
+    auto promise = std::make_shared<QPromise<QByteArray>>();
+    QThreadPool::globalInstance()->start([promise, image, maxImageSize] {
+        promise->start();
+        QByteArray pngData;
+        QBuffer buffer(&pngData);
+        buffer.open(QIODevice::WriteOnly);
+        ImageConverter::scaledImage(image, maxImageSize).save(&buffer, "PNG");
+        promise->addResult(pngData);
+        promise->finish();
+    });
+
+    pendingIcons.insert(id);
+    promise->future().then(q, [this, id, key, portalArgs, setIcon](const QByteArray &pngData) mutable {
+        iconCache.insert(key, new QByteArray(pngData), pngData.size());
+
+        if (!pendingIcons.remove(id)) {
+            // closed in the meantime
+            return;
+        }
 
-    args.append(QString::number(nextId));
-    args.append(portalArgs);
+        setIcon(portalArgs, pngData);
+        addPortalNotification(id, portalArgs);
+    });
 
-    dbusNotificationMessage.setArguments(args);
+    return true;
+}
 
-    QDBusPendingCall notificationCall = QDBusConnection::sessionBus().asyncCall(dbusNotificationMessage, -1);
+void NotifyByPortalPrivate::addPortalNotification(uint id, const QVariantMap &portalArgs)
+{
+    QDBusMessage dbusNotificationMessage = QDBusMessage::createMethodCall(QString::fromLatin1(portalDbusServiceName),
+                                                                          QString::fromLatin1(portalDbusPath),
+                                                                          QString::fromLatin1(portalDbusInterfaceName),
+                                                                          QStringLiteral("AddNotification"));
+    dbusNotificationMessage.setArguments({QString::number(id), portalArgs});
 
-    // If we are in sandbox we don't need to wait for returned notification id
-    portalNotifications.insert(nextId++, notification);
+    QDBusConnection::sessionBus().asyncCall(dbusNotificationMessage, -1);
+}
 
-    return true;
+uint NotifyByPortalPrivate::portalNotificationId(KNotification *notification) const
+{
+    const uint id = portalNotificationIds.value(notification, 0);
+    // the address may belong to a notification that was deleted while being shown
+    if (id == 0 || portalNotifications.value(id) != notification) {
+        return 0;
+    }
+    return id;
 }
 
 void NotifyByPortalPrivate::closePortalNotification(KNotification *notification)
 {
-    uint id = portalNotifications.key(notification, 0);
+    uint id = portalNotificationId(notification);
 
     qCDebug(LOG_KNOTIFICATIONS) << "ID: " << id;
 
@@ -343,6 +462,11 @@ void NotifyByPortalPrivate::closePortalNotification(KNotification *notification)
         return;
     }
 
+    if (pendingIcons.remove(id)) {
+        // not sent yet, and now it won't be
+        return;
+    }
+
     QDBusMessage m = QDBusMessage::createMethodCall(QString::fromLatin1(portalDbusServiceName),
                                                     QString::fromLatin1(portalDbusPath),
                                                     QString::fromLatin1(portalDbusInterfaceName),
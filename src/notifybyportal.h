@@ -33,6 +33,7 @@ public:
     void notify(KNotification *notification, const KNotifyConfig &notifyConfig) override;
     void close(KNotification *notification) override;
     void update(KNotification *notification, const KNotifyConfig &notifyConfig) override;
+    void replace(KNotification *previous, KNotification *notification, const KNotifyConfig &notifyConfig) override;
 
 private Q_SLOTS:
 
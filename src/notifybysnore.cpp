@@ -147,15 +147,16 @@ void NotifyBySnore::notify(KNotification *notification, const KNotifyConfig &not
     Q_UNUSED(notifyConfig);
     // HACK work around that notification->id() is only populated after returning from here
     // note that config will be invalid at that point, so we can't pass that along
+    // the image is taken along, it may be released once we return, see ReleaseImageAfterDelivery
     QMetaObject::invokeMethod(
         this,
-        [this, notification]() {
-            NotifyBySnore::notifyDeferred(notification);
+        [this, notification, image = notification->image()]() {
+            NotifyBySnore::notifyDeferred(notification, image);
         },
         Qt::QueuedConnection);
 }
 
-void NotifyBySnore::notifyDeferred(KNotification *notification)
+void NotifyBySnore::notifyDeferred(KNotification *notification, const QImage &image)
 {
     m_notifications.insert(notification->id(), notification);
 
@@ -175,8 +176,8 @@ void NotifyBySnore::notifyDeferred(KNotification *notification)
 
     // handle the icon for toast notification
     const QString iconPath = m_iconDir.path() + QLatin1Char('/') + QString::number(notification->id());
-    const bool hasIcon = (notification->pixmap().isNull()) ? qApp->windowIcon().pixmap(1024, 1024).save(iconPath, "PNG") //
-                                                           : notification->pixmap().save(iconPath, "PNG");
+    const bool hasIcon = image.isNull() ? qApp->windowIcon().pixmap(1024, 1024).save(iconPath, "PNG") //
+                                        : image.save(iconPath, "PNG");
     if (hasIcon) {
         snoretoastArgsList << QStringLiteral("-p") << iconPath;
     }
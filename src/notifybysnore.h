@@ -9,6 +9,7 @@
 
 #include "knotificationplugin.h"
 
+#include <QImage>
 #include <QLocalServer>
 #include <QPointer>
 #include <QProcess>
@@ -27,7 +28,7 @@ public:
         return QStringLiteral("Popup");
     }
     void notify(KNotification *notification, const KNotifyConfig &notifyConfig) override;
-    void notifyDeferred(KNotification *notification);
+    void notifyDeferred(KNotification *notification, const QImage &image);
     void close(KNotification *notification) override;
     void update(KNotification *notification, const KNotifyConfig &notifyConfig) override;
 
@@ -0,0 +1,333 @@
+/*
+    SPDX-FileCopyrightText: 2026 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+*/
+
+#include "notifyrccache.h"
+
+#include "debug_p.h"
+
+#include <KConfig>
+#include <KConfigGroup>
+
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QLocale>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QUrl>
+
+#include <algorithm>
+
+// "KNRC", bump s_version whenever the layout below changes
+static constexpr quint32 s_magic = 0x434e524b;
+static constexpr quint32 s_version = 2;
+
+/*
+ * The file consists of the Header, followed by groupCount Groups sorted by name,
+ * entryCount Entries (each group's entries being sorted by key) and finally
+ * stringCount UTF-16 code units all the names, keys and values point into.
+ *
+ * Every entry has its value as KConfigGroup::readEntry() and readPathEntry() return it,
+ * the latter pointing at the same string unless the path expansion changed it.
+ * Paths get a leading ~ expanded as well, see expandTilde().
+ */
+struct NotifyRcCache::Header {
+    quint32 magic;
+    quint32 version;
+    quint32 fingerprintOffset;
+    quint32 fingerprintLength;
+    quint32 groupCount;
+    quint32 entryCount;
+    quint32 stringCount;
+};
+
+struct NotifyRcCache::Group {
+    quint32 nameOffset;
+    quint32 nameLength;
+    quint32 firstEntry;
+    quint32 entryCount;
+};
+
+struct NotifyRcCache::Entry {
+    quint32 keyOffset;
+    quint32 keyLength;
+    quint32 valueOffset;
+    quint32 valueLength;
+    quint32 pathValueOffset;
+    quint32 pathValueLength;
+};
+
+/*
+ * Describes the source files the cache is compiled from, so that any change to them
+ * (or to the locale whose translations ended up in the cache) invalidates it.
+ *
+ * Returns a null string if there are no source files at all.
+ */
+static QString sourceFingerprint(const QString &relativePath, const QString &locale)
+{
+    QStringList sources = QStandardPaths::locateAll(QStandardPaths::GenericDataLocation, relativePath);
+    const QString resource = QLatin1String(":/") + relativePath;
+    if (QFileInfo::exists(resource)) {
+        sources.append(resource);
+    }
+
+    if (sources.isEmpty()) {
+        return QString();
+    }
+
+    QString fingerprint = locale;
+    for (const QString &source : std::as_const(sources)) {
+        const QFileInfo info(source);
+        fingerprint += QLatin1Char('\n') + source + QLatin1Char(':') + QString::number(info.size()) + QLatin1Char(':')
+            + QString::number(info.lastModified().toMSecsSinceEpoch());
+    }
+    return fingerprint;
+}
+
+bool NotifyRcCache::compile(const QString &relativePath, const QString &locale, const QString &fingerprint, const QString &cacheFileName)
+{
+    KConfig config(relativePath, KConfig::NoGlobals, QStandardPaths::GenericDataLocation);
+    // also search for event config files in qrc resources
+    config.addConfigSources({QLatin1String(":/") + relativePath});
+    config.setLocale(locale);
+
+    struct CompiledEntry {
+        QString key;
+        QString value;
+        QString pathValue;
+    };
+    struct CompiledGroup {
+        QString name;
+        QList<CompiledEntry> entries;
+    };
+
+    QList<CompiledGroup> groups;
+    const QStringList groupNames = config.groupList();
+    groups.reserve(groupNames.size());
+    for (const QString &groupName : groupNames) {
+        const KConfigGroup group = config.group(groupName);
+        CompiledGroup compiled{groupName, {}};
+        const QStringList keys = group.keyList();
+        compiled.entries.reserve(keys.size());
+        for (const QString &key : keys) {
+            compiled.entries.append({key, group.readEntry(key, QString()), expandTilde(group.readPathEntry(key, QString()))});
+        }
+        std::sort(compiled.entries.begin(), compiled.entries.end(), [](const CompiledEntry &a, const CompiledEntry &b) {
+            return a.key < b.key;
+        });
+        groups.append(std::move(compiled));
+    }
+    std::sort(groups.begin(), groups.end(), [](const CompiledGroup &a, const CompiledGroup &b) {
+        return a.name < b.name;
+    });
+
+    QString strings;
+    auto addString = [&strings](const QString &s) {
+        const auto offset = quint32(strings.size());
+        strings += s;
+        return offset;
+    };
+
+    QByteArray groupTable;
+    QByteArray entryTable;
+    quint32 entryCount = 0;
+    for (const CompiledGroup &group : std::as_const(groups)) {
+        const Group record{addString(group.name), quint32(group.name.size()), entryCount, quint32(group.entries.size())};
+        groupTable.append(reinterpret_cast<const char *>(&record), sizeof(record));
+
+        for (const CompiledEntry &compiled : group.entries) {
+            const quint32 valueOffset = addString(compiled.value);
+            const quint32 pathValueOffset = compiled.pathValue == compiled.value ? valueOffset : addString(compiled.pathValue);
+            const Entry entry{addString(compiled.key),
+                              quint32(compiled.key.size()),
+                              valueOffset,
+                              quint32(compiled.value.size()),
+                              pathValueOffset,
+                              quint32(compiled.pathValue.size())};
+            entryTable.append(reinterpret_cast<const char *>(&entry), sizeof(entry));
+            ++entryCount;
+        }
+    }
+
+    const Header header{s_magic, s_version, addString(fingerprint), quint32(fingerprint.size()), quint32(groups.size()), entryCount, quint32(strings.size())};
+
+    QSaveFile file(cacheFileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCDebug(LOG_KNOTIFICATIONS) << "Cannot write notifyrc cache" << cacheFileName << file.errorString();
+        return false;
+    }
+
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(groupTable);
+    file.write(entryTable);
+    file.write(reinterpret_cast<const char *>(strings.constData()), strings.size() * sizeof(QChar));
+
+    // QSaveFile replaces the old cache atomically, so processes still mapping it are not affected
+    return file.commit();
+}
+
+std::shared_ptr<const NotifyRcCache> NotifyRcCache::open(const QString &applicationName)
+{
+    const QString relativePath = QLatin1String("knotifications6/") + applicationName + QLatin1String(".notifyrc");
+    const QString locale = QLocale().name();
+
+    const QString fingerprint = sourceFingerprint(relativePath, locale);
+    if (fingerprint.isNull()) {
+        return nullptr;
+    }
+
+    const QString cacheDir = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + QLatin1String("/knotifications6");
+    // the application name may contain anything, e.g. slashes
+    const QString escapedName = QString::fromLatin1(QUrl::toPercentEncoding(applicationName));
+    const QString cacheFileName = cacheDir + QLatin1Char('/') + escapedName + QLatin1Char('_') + locale + QLatin1String(".cache");
+
+    std::shared_ptr<NotifyRcCache> cache(new NotifyRcCache);
+    if (cache->map(cacheFileName, fingerprint)) {
+        return cache;
+    }
+
+    if (!QDir().mkpath(cacheDir) || !compile(relativePath, locale, fingerprint, cacheFileName)) {
+        return nullptr;
+    }
+
+    cache.reset(new NotifyRcCache);
+    if (cache->map(cacheFileName, fingerprint)) {
+        return cache;
+    }
+
+    qCWarning(LOG_KNOTIFICATIONS) << "Failed to map freshly compiled notifyrc cache" << cacheFileName;
+    return nullptr;
+}
+
+NotifyRcCache::~NotifyRcCache()
+{
+    if (m_data) {
+        m_file.unmap(const_cast<uchar *>(m_data));
+    }
+}
+
+qint64 NotifyRcCache::size() const
+{
+    return m_size;
+}
+
+bool NotifyRcCache::map(const QString &fileName, QStringView fingerprint)
+{
+    m_file.setFileName(fileName);
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    m_size = m_file.size();
+    if (m_size < qint64(sizeof(Header))) {
+        return false;
+    }
+
+    m_data = m_file.map(0, m_size);
+    if (!m_data) {
+        return false;
+    }
+
+    const auto *header = reinterpret_cast<const Header *>(m_data);
+    if (header->magic != s_magic || header->version != s_version) {
+        return false;
+    }
+
+    const qint64 expectedSize = qint64(sizeof(Header)) + qint64(header->groupCount) * qint64(sizeof(Group)) + qint64(header->entryCount) * qint64(sizeof(Entry))
+        + qint64(header->stringCount) * qint64(sizeof(char16_t));
+    if (expectedSize != m_size) {
+        return false;
+    }
+
+    m_groups = reinterpret_cast<const Group *>(m_data + sizeof(Header));
+    m_groupCount = header->groupCount;
+    m_entries = reinterpret_cast<const Entry *>(m_groups + m_groupCount);
+    m_entryCount = header->entryCount;
+    m_strings = reinterpret_cast<const char16_t *>(m_entries + m_entryCount);
+    m_stringCount = header->stringCount;
+
+    // Everything is checked once here, so that lookups can trust the offsets
+    auto validString = [this](quint32 offset, quint32 length) {
+        return quint64(offset) + quint64(length) <= m_stringCount;
+    };
+
+    if (!validString(header->fingerprintOffset, header->fingerprintLength)) {
+        return false;
+    }
+    for (quint32 i = 0; i < m_groupCount; ++i) {
+        const Group &group = m_groups[i];
+        if (!validString(group.nameOffset, group.nameLength) || quint64(group.firstEntry) + quint64(group.entryCount) > m_entryCount) {
+            return false;
+        }
+    }
+    for (quint32 i = 0; i < m_entryCount; ++i) {
+        const Entry &entry = m_entries[i];
+        if (!validString(entry.keyOffset, entry.keyLength) || !validString(entry.valueOffset, entry.valueLength)
+            || !validString(entry.pathValueOffset, entry.pathValueLength)) {
+            return false;
+        }
+    }
+
+    return string(header->fingerprintOffset, header->fingerprintLength) == fingerprint;
+}
+
+QStringView NotifyRcCache::string(quint32 offset, quint32 length) const
+{
+    return QStringView(m_strings + offset, qsizetype(length));
+}
+
+const NotifyRcCache::Group *NotifyRcCache::findGroup(QStringView name) const
+{
+    const Group *end = m_groups + m_groupCount;
+    const Group *it = std::lower_bound(m_groups, end, name, [this](const Group &group, QStringView name) {
+        return string(group.nameOffset, group.nameLength).compare(name) < 0;
+    });
+
+    if (it == end || string(it->nameOffset, it->nameLength) != name) {
+        return nullptr;
+    }
+    return it;
+}
+
+bool NotifyRcCache::hasGroup(QStringView group) const
+{
+    return findGroup(group) != nullptr;
+}
+
+QString NotifyRcCache::readEntry(QStringView group, QStringView key, bool path) const
+{
+    const Group *g = findGroup(group);
+    if (!g) {
+        return QString();
+    }
+
+    const Entry *begin = m_entries + g->firstEntry;
+    const Entry *end = begin + g->entryCount;
+    const Entry *it = std::lower_bound(begin, end, key, [this](const Entry &entry, QStringView key) {
+        return string(entry.keyOffset, entry.keyLength).compare(key) < 0;
+    });
+
+    if (it == end || string(it->keyOffset, it->keyLength) != key) {
+        return QString();
+    }
+
+    const quint32 offset = path ? it->pathValueOffset : it->valueOffset;
+    const quint32 length = path ? it->pathValueLength : it->valueLength;
+    if (length == 0) {
+        // an empty value is not the same as a missing one
+        return QStringLiteral("");
+    }
+    return string(offset, length).toString();
+}
+
+QString NotifyRcCache::expandTilde(const QString &path)
+{
+    // ~user is left alone, as KShell::tildeExpand() does if there is no such user
+    if (path == QLatin1String("~") || path.startsWith(QLatin1String("~/"))) {
+        return QDir::homePath() + path.mid(1);
+    }
+    return path;
+}
@@ -0,0 +1,88 @@
+/*
+    SPDX-FileCopyrightText: 2026 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+*/
+
+#ifndef NOTIFYRCCACHE_H
+#define NOTIFYRCCACHE_H
+
+#include <QFile>
+#include <QString>
+#include <QStringView>
+
+#include <memory>
+
+/*
+ * A compiled, memory-mapped copy of the knotifications6/<app>.notifyrc files
+ * of an application.
+ *
+ * The notifyrc files (including their translations for the current locale) are
+ * parsed once and written into a binary index in XDG_CACHE_HOME, which every
+ * process then just maps and looks up groups and entries in. The index is
+ * rebuilt whenever one of the source files changes.
+ */
+class NotifyRcCache
+{
+public:
+    /*
+     * Returns the compiled cache for the notifyrc file of applicationName,
+     * compiling it first if it is missing or out of date.
+     *
+     * Returns nullptr if no cache could be written or mapped, in which case
+     * the notifyrc file needs to be read directly.
+     */
+    static std::shared_ptr<const NotifyRcCache> open(const QString &applicationName);
+
+    ~NotifyRcCache();
+
+    /*
+     * Whether there is a group with the given name, e.g. "Global" or "Event/foo"
+     */
+    bool hasGroup(QStringView group) const;
+
+    /*
+     * Returns the entry key from the given group, or a null string if it doesn't exist
+     *
+     * If path is set, the value is expanded like KConfigGroup::readPathEntry() does,
+     * see also expandTilde().
+     */
+    QString readEntry(QStringView group, QStringView key, bool path = false) const;
+
+    /*
+     * Expands a leading ~ in path to the home directory, like a shell does
+     */
+    static QString expandTilde(const QString &path);
+
+    /*
+     * The size of the mapping, in bytes
+     */
+    qint64 size() const;
+
+private:
+    NotifyRcCache() = default;
+
+    struct Header;
+    struct Group;
+    struct Entry;
+
+    static bool compile(const QString &relativePath, const QString &locale, const QString &fingerprint, const QString &cacheFileName);
+    bool map(const QString &fileName, QStringView fingerprint);
+    const Group *findGroup(QStringView group) const;
+    QStringView string(quint32 offset, quint32 length) const;
+
+    QFile m_file;
+    const uchar *m_data = nullptr;
+    qint64 m_size = 0;
+
+    const Group *m_groups = nullptr;
+    quint32 m_groupCount = 0;
+    const Entry *m_entries = nullptr;
+    quint32 m_entryCount = 0;
+    const char16_t *m_strings = nullptr;
+    quint32 m_stringCount = 0;
+
+    Q_DISABLE_COPY_MOVE(NotifyRcCache)
+};
+
+#endif
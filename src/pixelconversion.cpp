@@ -0,0 +1,233 @@
+/*
+    SPDX-FileCopyrightText: 2026 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+*/
+
+#include "pixelconversion.h"
+
+#include <QRgb>
+
+#include <cstring>
+
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+#if defined(__SSE2__) || defined(_M_X64)
+#define KNOTIFICATIONS_SSE2
+#include <emmintrin.h>
+#if defined(__GNUC__) && defined(__x86_64__)
+// compiled for AVX2 regardless of the target, and only used if the CPU supports it
+#define KNOTIFICATIONS_AVX2
+#include <immintrin.h>
+#endif
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define KNOTIFICATIONS_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+/*
+ * All kernels compute (c * 255 + a / 2) / a for every color channel c, clamped to 255,
+ * and 0 for a == 0. The vector ones divide in single precision, which is exact here:
+ * the numerator is below 2^16, so the quotient is never rounded up to the next integer.
+ */
+namespace PixelConversion
+{
+static void convertScalar(const uchar *src, uchar *dst, qsizetype count)
+{
+    for (qsizetype i = 0; i < count; ++i) {
+        QRgb pixel;
+        std::memcpy(&pixel, src + i * 4, sizeof(pixel));
+
+        const uint a = qAlpha(pixel);
+        uchar *out = dst + i * 4;
+        if (a == 0) {
+            std::memset(out, 0, 4);
+            continue;
+        }
+
+        auto unpremultiply = [a](uint c) {
+            return uchar(qMin((c * 255 + a / 2) / a, 255u));
+        };
+        out[0] = unpremultiply(qRed(pixel));
+        out[1] = unpremultiply(qGreen(pixel));
+        out[2] = unpremultiply(qBlue(pixel));
+        out[3] = uchar(a);
+    }
+}
+
+#ifdef KNOTIFICATIONS_SSE2
+// 4 pixels, stored as B G R A bytes
+static inline __m128i convertSse2(__m128i pixels)
+{
+    const __m128i mask = _mm_set1_epi32(0xff);
+    const __m128i alpha = _mm_srli_epi32(pixels, 24);
+    const __m128 alphaF = _mm_cvtepi32_ps(alpha);
+    const __m128 halfAlpha = _mm_cvtepi32_ps(_mm_srli_epi32(alpha, 1));
+    const __m128 max = _mm_set1_ps(255.0f);
+
+    auto unpremultiply = [&](__m128i c) {
+        const __m128 numerator = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(c), max), halfAlpha);
+        return _mm_cvttps_epi32(_mm_min_ps(_mm_div_ps(numerator, alphaF), max));
+    };
+
+    const __m128i b = unpremultiply(_mm_and_si128(pixels, mask));
+    const __m128i g = unpremultiply(_mm_and_si128(_mm_srli_epi32(pixels, 8), mask));
+    const __m128i r = unpremultiply(_mm_and_si128(_mm_srli_epi32(pixels, 16), mask));
+
+    // R G B A bytes
+    const __m128i result = _mm_or_si128(_mm_or_si128(r, _mm_slli_epi32(g, 8)), _mm_or_si128(_mm_slli_epi32(b, 16), _mm_slli_epi32(alpha, 24)));
+    // 0 / 0 gives NaN, fully transparent pixels are all zeroes
+    return _mm_andnot_si128(_mm_cmpeq_epi32(alpha, _mm_setzero_si128()), result);
+}
+
+static qsizetype convertSse2(const uchar *src, uchar *dst, qsizetype count)
+{
+    qsizetype i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 4));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i * 4), convertSse2(pixels));
+    }
+    return i;
+}
+#endif
+
+#ifdef KNOTIFICATIONS_AVX2
+__attribute__((target("avx2"))) static inline __m256i unpremultiplyAvx2(__m256i c, __m256 alpha, __m256 halfAlpha)
+{
+    const __m256 max = _mm256_set1_ps(255.0f);
+    const __m256 numerator = _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(c), max), halfAlpha);
+    return _mm256_cvttps_epi32(_mm256_min_ps(_mm256_div_ps(numerator, alpha), max));
+}
+
+// 8 pixels, stored as B G R A bytes
+__attribute__((target("avx2"))) static inline __m256i convertAvx2(__m256i pixels)
+{
+    const __m256i mask = _mm256_set1_epi32(0xff);
+    const __m256i alpha = _mm256_srli_epi32(pixels, 24);
+    const __m256 alphaF = _mm256_cvtepi32_ps(alpha);
+    const __m256 halfAlpha = _mm256_cvtepi32_ps(_mm256_srli_epi32(alpha, 1));
+
+    const __m256i b = unpremultiplyAvx2(_mm256_and_si256(pixels, mask), alphaF, halfAlpha);
+    const __m256i g = unpremultiplyAvx2(_mm256_and_si256(_mm256_srli_epi32(pixels, 8), mask), alphaF, halfAlpha);
+    const __m256i r = unpremultiplyAvx2(_mm256_and_si256(_mm256_srli_epi32(pixels, 16), mask), alphaF, halfAlpha);
+
+    const __m256i result =
+        _mm256_or_si256(_mm256_or_si256(r, _mm256_slli_epi32(g, 8)), _mm256_or_si256(_mm256_slli_epi32(b, 16), _mm256_slli_epi32(alpha, 24)));
+    return _mm256_andnot_si256(_mm256_cmpeq_epi32(alpha, _mm256_setzero_si256()), result);
+}
+
+__attribute__((target("avx2"))) static qsizetype convertAvx2(const uchar *src, uchar *dst, qsizetype count)
+{
+    qsizetype i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i * 4));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i * 4), convertAvx2(pixels));
+    }
+    return i;
+}
+
+static bool hasAvx2()
+{
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+}
+#endif
+
+#ifdef KNOTIFICATIONS_NEON
+// 4 values of one channel
+static inline uint32x4_t unpremultiplyNeon(uint16x4_t c, uint16x4_t a)
+{
+    const uint32x4_t alpha = vmovl_u16(a);
+    const float32x4_t numerator = vaddq_f32(vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(c)), 255.0f), vcvtq_f32_u32(vshrq_n_u32(alpha, 1)));
+    const uint32x4_t result = vcvtq_u32_f32(vminq_f32(vdivq_f32(numerator, vcvtq_f32_u32(alpha)), vdupq_n_f32(255.0f)));
+    return vbicq_u32(result, vceqq_u32(alpha, vdupq_n_u32(0)));
+}
+
+// 16 values of one channel
+static inline uint8x16_t unpremultiplyNeon(uint8x16_t c, uint8x16_t a)
+{
+    const uint16x8_t cLow = vmovl_u8(vget_low_u8(c));
+    const uint16x8_t cHigh = vmovl_u8(vget_high_u8(c));
+    const uint16x8_t aLow = vmovl_u8(vget_low_u8(a));
+    const uint16x8_t aHigh = vmovl_u8(vget_high_u8(a));
+
+    const uint16x8_t low = vcombine_u16(vmovn_u32(unpremultiplyNeon(vget_low_u16(cLow), vget_low_u16(aLow))),
+                                        vmovn_u32(unpremultiplyNeon(vget_high_u16(cLow), vget_high_u16(aLow))));
+    const uint16x8_t high = vcombine_u16(vmovn_u32(unpremultiplyNeon(vget_low_u16(cHigh), vget_low_u16(aHigh))),
+                                         vmovn_u32(unpremultiplyNeon(vget_high_u16(cHigh), vget_high_u16(aHigh))));
+    return vcombine_u8(vmovn_u16(low), vmovn_u16(high));
+}
+
+static qsizetype convertNeon(const uchar *src, uchar *dst, qsizetype count)
+{
+    qsizetype i = 0;
+    for (; i + 16 <= count; i += 16) {
+        // B G R A bytes, split into one register per channel
+        const uint8x16x4_t pixels = vld4q_u8(src + i * 4);
+        uint8x16x4_t result;
+        result.val[0] = unpremultiplyNeon(pixels.val[2], pixels.val[3]);
+        result.val[1] = unpremultiplyNeon(pixels.val[1], pixels.val[3]);
+        result.val[2] = unpremultiplyNeon(pixels.val[0], pixels.val[3]);
+        result.val[3] = pixels.val[3];
+        vst4q_u8(dst + i * 4, result);
+    }
+    return i;
+}
+#endif
+
+void argb32PremultipliedToRgba8888(const uchar *src, uchar *dst, qsizetype count)
+{
+    qsizetype done = 0;
+#if defined(KNOTIFICATIONS_AVX2)
+    if (hasAvx2()) {
+        done = convertAvx2(src, dst, count);
+    } else {
+        done = convertSse2(src, dst, count);
+    }
+#elif defined(KNOTIFICATIONS_SSE2)
+    done = convertSse2(src, dst, count);
+#elif defined(KNOTIFICATIONS_NEON)
+    done = convertNeon(src, dst, count);
+#endif
+
+    // whatever did not fill a whole vector
+    convertScalar(src + done * 4, dst + done * 4, count - done);
+}
+
+bool argb32PremultipliedToRgba8888(Kernel kernel, const uchar *src, uchar *dst, qsizetype count)
+{
+    qsizetype done = 0;
+    switch (kernel) {
+    case Kernel::Scalar:
+        break;
+    case Kernel::Sse2:
+#ifdef KNOTIFICATIONS_SSE2
+        done = convertSse2(src, dst, count);
+        break;
+#else
+        return false;
+#endif
+    case Kernel::Avx2:
+#ifdef KNOTIFICATIONS_AVX2
+        if (!hasAvx2()) {
+            return false;
+        }
+        done = convertAvx2(src, dst, count);
+        break;
+#else
+        return false;
+#endif
+    case Kernel::Neon:
+#ifdef KNOTIFICATIONS_NEON
+        done = convertNeon(src, dst, count);
+        break;
+#else
+        return false;
+#endif
+    }
+
+    convertScalar(src + done * 4, dst + done * 4, count - done);
+    return true;
+}
+
+} // namespace
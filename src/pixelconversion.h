@@ -0,0 +1,43 @@
+/*
+    SPDX-FileCopyrightText: 2026 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+*/
+
+#ifndef PIXELCONVERSION_H
+#define PIXELCONVERSION_H
+
+#include "knotifications_export.h"
+
+#include <QtGlobal>
+
+namespace PixelConversion
+{
+/*
+ * Converts count pixels from QImage::Format_ARGB32_Premultiplied at src
+ * to QImage::Format_RGBA8888 (i.e. not premultiplied) at dst.
+ *
+ * Uses SSE2, AVX2 or NEON where available.
+ */
+void argb32PremultipliedToRgba8888(const uchar *src, uchar *dst, qsizetype count);
+
+/*
+ * The implementations argb32PremultipliedToRgba8888() picks from
+ */
+enum class Kernel {
+    Scalar,
+    Sse2,
+    Avx2,
+    Neon,
+};
+
+/*
+ * The same with the given kernel, the pixels that do not fill a whole vector are
+ * converted by the scalar one. Returns false if the kernel is not compiled in or
+ * the CPU does not support it. For testing the kernels against each other.
+ */
+KNOTIFICATIONS_TESTS_EXPORT bool argb32PremultipliedToRgba8888(Kernel kernel, const uchar *src, uchar *dst, qsizetype count);
+
+} // namespace
+
+#endif
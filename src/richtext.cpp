@@ -0,0 +1,913 @@
+/*
+    SPDX-FileCopyrightText: 2026 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+*/
+
+#include "richtext.h"
+
+#include <QCache>
+#include <QHash>
+#include <QMutex>
+#include <QHashFunctions>
+#include <QTextBoundaryFinder>
+#include <QtAlgorithms>
+
+#include <algorithm>
+#include <iterator>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define KNOTIFICATIONS_SSE2
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define KNOTIFICATIONS_NEON
+#endif
+
+namespace RichText
+{
+qsizetype findMarkup(QStringView text, qsizetype from)
+{
+    const char16_t *data = text.utf16();
+    const qsizetype size = text.size();
+    qsizetype i = from;
+
+#if defined(KNOTIFICATIONS_SSE2)
+    const __m128i lt = _mm_set1_epi16('<');
+    const __m128i amp = _mm_set1_epi16('&');
+    for (; i + 8 <= size; i += 8) {
+        const __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        const int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi16(chars, lt), _mm_cmpeq_epi16(chars, amp)));
+        if (mask) {
+            // two mask bits per character
+            return i + qCountTrailingZeroBits(uint(mask)) / 2;
+        }
+    }
+#elif defined(KNOTIFICATIONS_NEON)
+    const uint16x8_t lt = vdupq_n_u16('<');
+    const uint16x8_t amp = vdupq_n_u16('&');
+    for (; i + 8 <= size; i += 8) {
+        const uint16x8_t chars = vld1q_u16(reinterpret_cast<const uint16_t *>(data + i));
+        const uint16x8_t matches = vorrq_u16(vceqq_u16(chars, lt), vceqq_u16(chars, amp));
+        if (vmaxvq_u16(matches)) {
+            break;
+        }
+    }
+#endif
+
+    for (; i < size; ++i) {
+        if (data[i] == u'<' || data[i] == u'&') {
+            return i;
+        }
+    }
+    return size;
+}
+
+bool mightContainMarkup(QStringView text)
+{
+    return findMarkup(text, 0) < text.size();
+}
+
+namespace
+{
+struct NamedEntity {
+    QLatin1StringView name;
+    char16_t value;
+};
+
+// the entities of HTML 4 and &apos;, the ones QTextDocument knows, sorted by name for the binary search in decodeEntity()
+constexpr NamedEntity s_entities[] = {
+    {QLatin1StringView("AElig"), 0x00c6},   {QLatin1StringView("Aacute"), 0x00c1},  {QLatin1StringView("Acirc"), 0x00c2},
+    {QLatin1StringView("Agrave"), 0x00c0},  {QLatin1StringView("Alpha"), 0x0391},   {QLatin1StringView("Aring"), 0x00c5},
+    {QLatin1StringView("Atilde"), 0x00c3},  {QLatin1StringView("Auml"), 0x00c4},    {QLatin1StringView("Beta"), 0x0392},
+    {QLatin1StringView("Ccedil"), 0x00c7},  {QLatin1StringView("Chi"), 0x03a7},     {QLatin1StringView("Dagger"), 0x2021},
+    {QLatin1StringView("Delta"), 0x0394},   {QLatin1StringView("ETH"), 0x00d0},     {QLatin1StringView("Eacute"), 0x00c9},
+    {QLatin1StringView("Ecirc"), 0x00ca},   {QLatin1StringView("Egrave"), 0x00c8},  {QLatin1StringView("Epsilon"), 0x0395},
+    {QLatin1StringView("Eta"), 0x0397},     {QLatin1StringView("Euml"), 0x00cb},    {QLatin1StringView("Gamma"), 0x0393},
+    {QLatin1StringView("Iacute"), 0x00cd},  {QLatin1StringView("Icirc"), 0x00ce},   {QLatin1StringView("Igrave"), 0x00cc},
+    {QLatin1StringView("Iota"), 0x0399},    {QLatin1StringView("Iuml"), 0x00cf},    {QLatin1StringView("Kappa"), 0x039a},
+    {QLatin1StringView("Lambda"), 0x039b},  {QLatin1StringView("Mu"), 0x039c},      {QLatin1StringView("Ntilde"), 0x00d1},
+    {QLatin1StringView("Nu"), 0x039d},      {QLatin1StringView("OElig"), 0x0152},   {QLatin1StringView("Oacute"), 0x00d3},
+    {QLatin1StringView("Ocirc"), 0x00d4},   {QLatin1StringView("Ograve"), 0x00d2},  {QLatin1StringView("Omega"), 0x03a9},
+    {QLatin1StringView("Omicron"), 0x039f}, {QLatin1StringView("Oslash"), 0x00d8},  {QLatin1StringView("Otilde"), 0x00d5},
+    {QLatin1StringView("Ouml"), 0x00d6},    {QLatin1StringView("Phi"), 0x03a6},     {QLatin1StringView("Pi"), 0x03a0},
+    {QLatin1StringView("Prime"), 0x2033},   {QLatin1StringView("Psi"), 0x03a8},     {QLatin1StringView("Rho"), 0x03a1},
+    {QLatin1StringView("Scaron"), 0x0160},  {QLatin1StringView("Sigma"), 0x03a3},   {QLatin1StringView("THORN"), 0x00de},
+    {QLatin1StringView("Tau"), 0x03a4},     {QLatin1StringView("Theta"), 0x0398},   {QLatin1StringView("Uacute"), 0x00da},
+    {QLatin1StringView("Ucirc"), 0x00db},   {QLatin1StringView("Ugrave"), 0x00d9},  {QLatin1StringView("Upsilon"), 0x03a5},
+    {QLatin1StringView("Uuml"), 0x00dc},    {QLatin1StringView("Xi"), 0x039e},      {QLatin1StringView("Yacute"), 0x00dd},
+    {QLatin1StringView("Yuml"), 0x0178},    {QLatin1StringView("Zeta"), 0x0396},    {QLatin1StringView("aacute"), 0x00e1},
+    {QLatin1StringView("acirc"), 0x00e2},   {QLatin1StringView("acute"), 0x00b4},   {QLatin1StringView("aelig"), 0x00e6},
+    {QLatin1StringView("agrave"), 0x00e0},  {QLatin1StringView("alefsym"), 0x2135}, {QLatin1StringView("alpha"), 0x03b1},
+    {QLatin1StringView("amp"), 0x0026},     {QLatin1StringView("and"), 0x2227},     {QLatin1StringView("ang"), 0x2220},
+    {QLatin1StringView("apos"), 0x0027},    {QLatin1StringView("aring"), 0x00e5},   {QLatin1StringView("asymp"), 0x2248},
+    {QLatin1StringView("atilde"), 0x00e3},  {QLatin1StringView("auml"), 0x00e4},    {QLatin1StringView("bdquo"), 0x201e},
+    {QLatin1StringView("beta"), 0x03b2},    {QLatin1StringView("brvbar"), 0x00a6},  {QLatin1StringView("bull"), 0x2022},
+    {QLatin1StringView("cap"), 0x2229},     {QLatin1StringView("ccedil"), 0x00e7},  {QLatin1StringView("cedil"), 0x00b8},
+    {QLatin1StringView("cent"), 0x00a2},    {QLatin1StringView("chi"), 0x03c7},     {QLatin1StringView("circ"), 0x02c6},
+    {QLatin1StringView("clubs"), 0x2663},   {QLatin1StringView("cong"), 0x2245},    {QLatin1StringView("copy"), 0x00a9},
+    {QLatin1StringView("crarr"), 0x21b5},   {QLatin1StringView("cup"), 0x222a},     {QLatin1StringView("curren"), 0x00a4},
+    {QLatin1StringView("dArr"), 0x21d3},    {QLatin1StringView("dagger"), 0x2020},  {QLatin1StringView("darr"), 0x2193},
+    {QLatin1StringView("deg"), 0x00b0},     {QLatin1StringView("delta"), 0x03b4},   {QLatin1StringView("diams"), 0x2666},
+    {QLatin1StringView("divide"), 0x00f7},  {QLatin1StringView("eacute"), 0x00e9},  {QLatin1StringView("ecirc"), 0x00ea},
+    {QLatin1StringView("egrave"), 0x00e8},  {QLatin1StringView("empty"), 0x2205},   {QLatin1StringView("emsp"), 0x2003},
+    {QLatin1StringView("ensp"), 0x2002},    {QLatin1StringView("epsilon"), 0x03b5}, {QLatin1StringView("equiv"), 0x2261},
+    {QLatin1StringView("eta"), 0x03b7},     {QLatin1StringView("eth"), 0x00f0},     {QLatin1StringView("euml"), 0x00eb},
+    {QLatin1StringView("euro"), 0x20ac},    {QLatin1StringView("exist"), 0x2203},   {QLatin1StringView("fnof"), 0x0192},
+    {QLatin1StringView("forall"), 0x2200},  {QLatin1StringView("frac12"), 0x00bd},  {QLatin1StringView("frac14"), 0x00bc},
+    {QLatin1StringView("frac34"), 0x00be},  {QLatin1StringView("frasl"), 0x2044},   {QLatin1StringView("gamma"), 0x03b3},
+    {QLatin1StringView("ge"), 0x2265},      {QLatin1StringView("gt"), 0x003e},      {QLatin1StringView("hArr"), 0x21d4},
+    {QLatin1StringView("harr"), 0x2194},    {QLatin1StringView("hearts"), 0x2665},  {QLatin1StringView("hellip"), 0x2026},
+    {QLatin1StringView("iacute"), 0x00ed},  {QLatin1StringView("icirc"), 0x00ee},   {QLatin1StringView("iexcl"), 0x00a1},
+    {QLatin1StringView("igrave"), 0x00ec},  {QLatin1StringView("image"), 0x2111},   {QLatin1StringView("infin"), 0x221e},
+    {QLatin1StringView("int"), 0x222b},     {QLatin1StringView("iota"), 0x03b9},    {QLatin1StringView("iquest"), 0x00bf},
+    {QLatin1StringView("isin"), 0x2208},    {QLatin1StringView("iuml"), 0x00ef},    {QLatin1StringView("kappa"), 0x03ba},
+    {QLatin1StringView("lArr"), 0x21d0},    {QLatin1StringView("lambda"), 0x03bb},  {QLatin1StringView("lang"), 0x2329},
+    {QLatin1StringView("laquo"), 0x00ab},   {QLatin1StringView("larr"), 0x2190},    {QLatin1StringView("lceil"), 0x2308},
+    {QLatin1StringView("ldquo"), 0x201c},   {QLatin1StringView("le"), 0x2264},      {QLatin1StringView("lfloor"), 0x230a},
+    {QLatin1StringView("lowast"), 0x2217},  {QLatin1StringView("loz"), 0x25ca},     {QLatin1StringView("lrm"), 0x200e},
+    {QLatin1StringView("lsaquo"), 0x2039},  {QLatin1StringView("lsquo"), 0x2018},   {QLatin1StringView("lt"), 0x003c},
+    {QLatin1StringView("macr"), 0x00af},    {QLatin1StringView("mdash"), 0x2014},   {QLatin1StringView("micro"), 0x00b5},
+    {QLatin1StringView("middot"), 0x00b7},  {QLatin1StringView("minus"), 0x2212},   {QLatin1StringView("mu"), 0x03bc},
+    {QLatin1StringView("nabla"), 0x2207},   {QLatin1StringView("nbsp"), 0x00a0},    {QLatin1StringView("ndash"), 0x2013},
+    {QLatin1StringView("ne"), 0x2260},      {QLatin1StringView("ni"), 0x220b},      {QLatin1StringView("not"), 0x00ac},
+    {QLatin1StringView("notin"), 0x2209},   {QLatin1StringView("nsub"), 0x2284},    {QLatin1StringView("ntilde"), 0x00f1},
+    {QLatin1StringView("nu"), 0x03bd},      {QLatin1StringView("oacute"), 0x00f3},  {QLatin1StringView("ocirc"), 0x00f4},
+    {QLatin1StringView("oelig"), 0x0153},   {QLatin1StringView("ograve"), 0x00f2},  {QLatin1StringView("oline"), 0x203e},
+    {QLatin1StringView("omega"), 0x03c9},   {QLatin1StringView("omicron"), 0x03bf}, {QLatin1StringView("oplus"), 0x2295},
+    {QLatin1StringView("or"), 0x2228},      {QLatin1StringView("ordf"), 0x00aa},    {QLatin1StringView("ordm"), 0x00ba},
+    {QLatin1StringView("oslash"), 0x00f8},  {QLatin1StringView("otilde"), 0x00f5},  {QLatin1StringView("otimes"), 0x2297},
+    {QLatin1StringView("ouml"), 0x00f6},    {QLatin1StringView("para"), 0x00b6},    {QLatin1StringView("part"), 0x2202},
+    {QLatin1StringView("permil"), 0x2030},  {QLatin1StringView("perp"), 0x22a5},    {QLatin1StringView("phi"), 0x03c6},
+    {QLatin1StringView("pi"), 0x03c0},      {QLatin1StringView("piv"), 0x03d6},     {QLatin1StringView("plusmn"), 0x00b1},
+    {QLatin1StringView("pound"), 0x00a3},   {QLatin1StringView("prime"), 0x2032},   {QLatin1StringView("prod"), 0x220f},
+    {QLatin1StringView("prop"), 0x221d},    {QLatin1StringView("psi"), 0x03c8},     {QLatin1StringView("quot"), 0x0022},
+    {QLatin1StringView("rArr"), 0x21d2},    {QLatin1StringView("radic"), 0x221a},   {QLatin1StringView("rang"), 0x232a},
+    {QLatin1StringView("raquo"), 0x00bb},   {QLatin1StringView("rarr"), 0x2192},    {QLatin1StringView("rceil"), 0x2309},
+    {QLatin1StringView("rdquo"), 0x201d},   {QLatin1StringView("real"), 0x211c},    {QLatin1StringView("reg"), 0x00ae},
+    {QLatin1StringView("rfloor"), 0x230b},  {QLatin1StringView("rho"), 0x03c1},     {QLatin1StringView("rlm"), 0x200f},
+    {QLatin1StringView("rsaquo"), 0x203a},  {QLatin1StringView("rsquo"), 0x2019},   {QLatin1StringView("sbquo"), 0x201a},
+    {QLatin1StringView("scaron"), 0x0161},  {QLatin1StringView("sdot"), 0x22c5},    {QLatin1StringView("sect"), 0x00a7},
+    {QLatin1StringView("shy"), 0x00ad},     {QLatin1StringView("sigma"), 0x03c3},   {QLatin1StringView("sigmaf"), 0x03c2},
+    {QLatin1StringView("sim"), 0x223c},     {QLatin1StringView("spades"), 0x2660},  {QLatin1StringView("sub"), 0x2282},
+    {QLatin1StringView("sube"), 0x2286},    {QLatin1StringView("sum"), 0x2211},     {QLatin1StringView("sup"), 0x2283},
+    {QLatin1StringView("sup1"), 0x00b9},    {QLatin1StringView("sup2"), 0x00b2},    {QLatin1StringView("sup3"), 0x00b3},
+    {QLatin1StringView("supe"), 0x2287},    {QLatin1StringView("szlig"), 0x00df},   {QLatin1StringView("tau"), 0x03c4},
+    {QLatin1StringView("there4"), 0x2234},  {QLatin1StringView("theta"), 0x03b8},   {QLatin1StringView("thetasym"), 0x03d1},
+    {QLatin1StringView("thinsp"), 0x2009},  {QLatin1StringView("thorn"), 0x00fe},   {QLatin1StringView("tilde"), 0x02dc},
+    {QLatin1StringView("times"), 0x00d7},   {QLatin1StringView("trade"), 0x2122},   {QLatin1StringView("uArr"), 0x21d1},
+    {QLatin1StringView("uacute"), 0x00fa},  {QLatin1StringView("uarr"), 0x2191},    {QLatin1StringView("ucirc"), 0x00fb},
+    {QLatin1StringView("ugrave"), 0x00f9},  {QLatin1StringView("uml"), 0x00a8},     {QLatin1StringView("upsih"), 0x03d2},
+    {QLatin1StringView("upsilon"), 0x03c5}, {QLatin1StringView("uuml"), 0x00fc},    {QLatin1StringView("weierp"), 0x2118},
+    {QLatin1StringView("xi"), 0x03be},      {QLatin1StringView("yacute"), 0x00fd},  {QLatin1StringView("yen"), 0x00a5},
+    {QLatin1StringView("yuml"), 0x00ff},    {QLatin1StringView("zeta"), 0x03b6},    {QLatin1StringView("zwj"), 0x200d},
+    {QLatin1StringView("zwnj"), 0x200c},
+};
+
+// elements that start a new line, everything else is inline
+constexpr QLatin1StringView s_blockElements[] = {
+    QLatin1StringView("address"), QLatin1StringView("blockquote"), QLatin1StringView("center"), QLatin1StringView("dd"), QLatin1StringView("div"),
+    QLatin1StringView("dl"),      QLatin1StringView("dt"),         QLatin1StringView("h1"),     QLatin1StringView("h2"), QLatin1StringView("h3"),
+    QLatin1StringView("h4"),      QLatin1StringView("h5"),         QLatin1StringView("h6"),     QLatin1StringView("hr"), QLatin1StringView("li"),
+    QLatin1StringView("ol"),      QLatin1StringView("p"),          QLatin1StringView("pre"),    QLatin1StringView("table"), QLatin1StringView("tr"),
+    QLatin1StringView("ul"),
+};
+
+// elements whose contents are not shown at all
+constexpr QLatin1StringView s_hiddenElements[] = {
+    QLatin1StringView("head"),
+    QLatin1StringView("script"),
+    QLatin1StringView("style"),
+    QLatin1StringView("title"),
+};
+
+template<size_t N>
+bool isOneOf(QStringView name, const QLatin1StringView (&names)[N])
+{
+    return std::any_of(std::begin(names), std::end(names), [name](QLatin1StringView candidate) {
+        return name.compare(candidate, Qt::CaseInsensitive) == 0;
+    });
+}
+
+bool isAsciiLetter(char16_t c)
+{
+    return (c >= u'a' && c <= u'z') || (c >= u'A' && c <= u'Z');
+}
+
+bool isAsciiLetterOrDigit(char16_t c)
+{
+    return isAsciiLetter(c) || (c >= u'0' && c <= u'9');
+}
+
+// the whitespace that HTML collapses
+bool isHtmlSpace(char16_t c)
+{
+    return c == u' ' || c == u'\t' || c == u'\n' || c == u'\r' || c == u'\f';
+}
+
+/*
+ * A tag at the '<' at text[pos], the tag ends right before end
+ */
+struct Tag {
+    QStringView name;
+    bool closing = false;
+    // the attributes are between the name and end
+    QStringView attributes;
+    qsizetype end = 0;
+};
+
+/*
+ * Parses the tag at text[pos], including comments, doctypes and processing instructions,
+ * which have no name. Returns false if the '<' does not start a tag.
+ */
+bool parseTag(QStringView text, qsizetype pos, Tag *tag)
+{
+    const qsizetype size = text.size();
+    qsizetype i = pos + 1;
+    if (i >= size) {
+        return false;
+    }
+
+    if (text.sliced(i).startsWith(u"!--")) {
+        const qsizetype close = text.indexOf(u"-->", i + 3);
+        tag->name = QStringView();
+        tag->end = close < 0 ? size : close + 3;
+        return true;
+    }
+
+    if (text[i] == u'!' || text[i] == u'?') {
+        const qsizetype close = text.indexOf(u'>', i);
+        tag->name = QStringView();
+        tag->end = close < 0 ? size : close + 1;
+        return true;
+    }
+
+    tag->closing = text[i] == u'/';
+    if (tag->closing) {
+        ++i;
+    }
+
+    // like browsers, "a < b" or "<3" is text rather than a broken tag
+    if (i >= size || !isAsciiLetter(text[i].unicode())) {
+        return false;
+    }
+
+    const qsizetype nameStart = i;
+    while (i < size && isAsciiLetterOrDigit(text[i].unicode())) {
+        ++i;
+    }
+    tag->name = text.sliced(nameStart, i - nameStart);
+    const qsizetype attributesStart = i;
+
+    // attribute values may contain a '>' as well
+    char16_t quote = 0;
+    for (; i < size; ++i) {
+        const char16_t c = text[i].unicode();
+        if (quote) {
+            if (c == quote) {
+                quote = 0;
+            }
+        } else if (c == u'"' || c == u'\'') {
+            quote = c;
+        } else if (c == u'>') {
+            tag->attributes = text.sliced(attributesStart, i - attributesStart);
+            tag->end = i + 1;
+            return true;
+        }
+    }
+
+    // an unterminated tag swallows the rest of the text
+    tag->attributes = text.sliced(attributesStart);
+    tag->end = size;
+    return true;
+}
+
+QString decodeEntities(QStringView text);
+
+/*
+ * Returns the value of the attribute name in attributes, with entities decoded,
+ * or a null string if there is no such attribute
+ */
+QString attributeValue(QStringView attributes, QLatin1StringView name)
+{
+    qsizetype i = 0;
+    const qsizetype size = attributes.size();
+    while (i < size) {
+        while (i < size && (isHtmlSpace(attributes[i].unicode()) || attributes[i] == u'/')) {
+            ++i;
+        }
+
+        const qsizetype nameStart = i;
+        while (i < size && !isHtmlSpace(attributes[i].unicode()) && attributes[i] != u'=' && attributes[i] != u'/') {
+            ++i;
+        }
+        const QStringView attributeName = attributes.sliced(nameStart, i - nameStart);
+
+        while (i < size && isHtmlSpace(attributes[i].unicode())) {
+            ++i;
+        }
+        QStringView value;
+        if (i < size && attributes[i] == u'=') {
+            ++i;
+            while (i < size && isHtmlSpace(attributes[i].unicode())) {
+                ++i;
+            }
+            if (i < size && (attributes[i] == u'"' || attributes[i] == u'\'')) {
+                const QChar quote = attributes[i];
+                const qsizetype close = attributes.indexOf(quote, i + 1);
+                const qsizetype valueEnd = close < 0 ? size : close;
+                value = attributes.sliced(i + 1, valueEnd - i - 1);
+                i = valueEnd + 1;
+            } else {
+                const qsizetype valueStart = i;
+                while (i < size && !isHtmlSpace(attributes[i].unicode())) {
+                    ++i;
+                }
+                value = attributes.sliced(valueStart, i - valueStart);
+            }
+        }
+
+        if (attributeName.isEmpty()) {
+            ++i;
+        } else if (attributeName.compare(name, Qt::CaseInsensitive) == 0) {
+            return value.isNull() ? QStringLiteral("") : decodeEntities(value);
+        }
+    }
+    return QString();
+}
+
+enum class Output {
+    PlainText,
+    Markup,
+};
+
+struct ConversionKey {
+    QString text;
+    Output output;
+    qsizetype maxLength;
+
+    bool operator==(const ConversionKey &other) const
+    {
+        return output == other.output && maxLength == other.maxLength && text == other.text;
+    }
+};
+
+size_t qHash(const ConversionKey &key, size_t seed = 0)
+{
+    return qHashMulti(seed, key.text, int(key.output), key.maxLength);
+}
+
+/*
+ * The cache of converted texts, by the original text and how it was converted
+ */
+class ConversionCache
+{
+public:
+    static constexpr qsizetype budget = 256 * 1024;
+
+    ConversionCache()
+    {
+        m_cache.setMaxCost(budget);
+    }
+
+    bool find(const ConversionKey &key, QString *converted)
+    {
+        QMutexLocker locker(&m_mutex);
+        if (const QString *cached = m_cache.object(key)) {
+            *converted = *cached;
+            return true;
+        }
+        return false;
+    }
+
+    void insert(const ConversionKey &key, const QString &converted)
+    {
+        const qsizetype cost = (key.text.size() + converted.size()) * qsizetype(sizeof(QChar));
+        if (cost > budget / 4) {
+            // one huge text would push out everything else, and is unlikely to be repeated
+            return;
+        }
+
+        QMutexLocker locker(&m_mutex);
+        m_cache.insert(key, new QString(converted), cost);
+    }
+
+private:
+    QMutex m_mutex;
+    QCache<ConversionKey, QString> m_cache;
+};
+
+Q_GLOBAL_STATIC(ConversionCache, s_conversionCache)
+
+// what elided text ends with, a single character so that it fits any limit
+constexpr char16_t s_elisionMarker = u'\u2026';
+
+/*
+ * Returns the last grapheme boundary in text at or before pos, so that cutting there
+ * neither splits a surrogate pair nor separates combining marks from their base
+ */
+qsizetype graphemeBoundary(QStringView text, qsizetype pos)
+{
+    if (pos <= 0) {
+        return 0;
+    }
+    if (pos >= text.size()) {
+        return text.size();
+    }
+
+    // clusters are only a few code points long, looking at the text around pos keeps this
+    // from taking time proportional to the length of the whole text
+    constexpr qsizetype window = 32;
+    const qsizetype start = std::max<qsizetype>(0, pos - window);
+    const QStringView around = text.sliced(start, std::min(text.size(), pos + window) - start);
+
+    QTextBoundaryFinder finder(QTextBoundaryFinder::Grapheme, around);
+    finder.setPosition(pos - start);
+    if (finder.isAtBoundary()) {
+        return pos;
+    }
+    return start + std::max<qsizetype>(0, finder.toPreviousBoundary());
+}
+
+QString elidedText(const QString &text, qsizetype maxLength)
+{
+    if (maxLength <= 0 || text.size() <= maxLength) {
+        return text;
+    }
+
+    QString result = text.first(graphemeBoundary(text, maxLength - 1));
+    result += QChar(s_elisionMarker);
+    return result;
+}
+
+/*
+ * Converts HTML into plain text or the markup subset of the notification spec in one pass
+ */
+class Converter
+{
+public:
+    Converter(QStringView text, Output output, qsizetype maxLength)
+        : m_text(text)
+        , m_output(output)
+        , m_maxLength(maxLength)
+    {
+        m_result.reserve(maxLength > 0 ? std::min(text.size(), maxLength) : text.size());
+    }
+
+    QString convert();
+
+private:
+    // whether length more visible characters fit into maxLength
+    bool fits(qsizetype length) const
+    {
+        return m_maxLength <= 0 || m_length + length <= m_maxLength;
+    }
+
+    qsizetype separatorLength() const;
+    void beginText();
+    void appendChunk(QStringView text);
+    void elide();
+    void appendRun(QStringView run);
+    void appendText(QStringView text);
+    void appendLineBreak();
+    void handleTag(const Tag &tag, qsizetype *pos);
+    void handleMarkupTag(const Tag &tag);
+    void openTag(QLatin1StringView name, const QString &attributes = QString());
+    void closeTag(QLatin1StringView name);
+
+    const QStringView m_text;
+    const Output m_output;
+    const qsizetype m_maxLength;
+
+    QString m_result;
+    // visible characters in m_result
+    qsizetype m_length = 0;
+
+    // whether anything was left out because of maxLength, which ends the conversion
+    bool m_elided = false;
+    // where the last visible character is in m_result once maxLength is reached,
+    // it makes room for the elision marker if anything else follows
+    qsizetype m_lastStart = 0;
+    qsizetype m_lastEnd = 0;
+
+    // whitespace between words and line breaks between blocks are only added before the next word,
+    // so that there are none at the start or the end
+    bool m_pendingSpace = false;
+    bool m_pendingBreak = false;
+    int m_preDepth = 0;
+
+    // the markup elements that are open, innermost last
+    QList<QLatin1StringView> m_openTags;
+    // how many of each are in m_openTags, so that closing tags that match none are skipped right away
+    QHash<QLatin1StringView, qsizetype> m_openCounts;
+};
+
+// elements of the markup subset, and what they are written as
+struct MarkupElement {
+    QLatin1StringView name;
+    QLatin1StringView canonicalName;
+};
+
+constexpr MarkupElement s_markupElements[] = {
+    {QLatin1StringView("a"), QLatin1StringView("a")},
+    {QLatin1StringView("b"), QLatin1StringView("b")},
+    {QLatin1StringView("em"), QLatin1StringView("i")},
+    {QLatin1StringView("i"), QLatin1StringView("i")},
+    {QLatin1StringView("img"), QLatin1StringView("img")},
+    {QLatin1StringView("ins"), QLatin1StringView("u")},
+    {QLatin1StringView("strong"), QLatin1StringView("b")},
+    {QLatin1StringView("u"), QLatin1StringView("u")},
+};
+
+void appendEscaped(QString *result, QStringView text)
+{
+    for (const QChar c : text) {
+        switch (c.unicode()) {
+        case u'&':
+            *result += QLatin1StringView("&amp;");
+            break;
+        case u'<':
+            *result += QLatin1StringView("&lt;");
+            break;
+        case u'>':
+            *result += QLatin1StringView("&gt;");
+            break;
+        case u'"':
+            *result += QLatin1StringView("&quot;");
+            break;
+        default:
+            *result += c;
+            break;
+        }
+    }
+}
+
+// the length of the whitespace or line break beginText() adds
+qsizetype Converter::separatorLength() const
+{
+    if (!m_pendingBreak && !m_pendingSpace) {
+        return 0;
+    }
+    const bool atLineStart = m_result.isEmpty() || m_result.endsWith(u'\n');
+    return atLineStart ? 0 : 1;
+}
+
+void Converter::beginText()
+{
+    if (separatorLength() > 0) {
+        m_lastStart = m_result.size();
+        m_result += m_pendingBreak ? u'\n' : u' ';
+        m_lastEnd = m_result.size();
+        ++m_length;
+    }
+    m_pendingBreak = false;
+    m_pendingSpace = false;
+}
+
+void Converter::appendChunk(QStringView text)
+{
+    if (m_output == Output::Markup) {
+        appendEscaped(&m_result, text);
+    } else {
+        m_result += text;
+    }
+    m_length += text.size();
+}
+
+void Converter::elide()
+{
+    if (m_length < m_maxLength) {
+        m_result += QChar(s_elisionMarker);
+        ++m_length;
+    } else {
+        // whatever came last makes room for it, any tags after it stay as they are
+        m_result.replace(m_lastStart, m_lastEnd - m_lastStart, QChar(s_elisionMarker));
+    }
+    m_elided = true;
+}
+
+void Converter::appendText(QStringView text)
+{
+    if (text.isEmpty() || m_elided) {
+        return;
+    }
+
+    const qsizetype length = separatorLength() + text.size();
+    if (!fits(length)) {
+        // as much as fits next to the marker, up to the grapheme it would have split
+        const qsizetype cut = graphemeBoundary(text, m_maxLength - 1 - m_length - separatorLength());
+        if (cut > 0) {
+            beginText();
+            appendChunk(text.first(cut));
+        }
+        elide();
+        return;
+    }
+
+    beginText();
+    if (m_maxLength > 0 && m_length + text.size() == m_maxLength) {
+        // this fills it up, remember the last grapheme in case more follows
+        const qsizetype last = graphemeBoundary(text, text.size() - 1);
+        appendChunk(text.first(last));
+        m_lastStart = m_result.size();
+        appendChunk(text.sliced(last));
+        m_lastEnd = m_result.size();
+        return;
+    }
+    appendChunk(text);
+}
+
+void Converter::appendRun(QStringView run)
+{
+    if (m_preDepth > 0) {
+        appendText(run);
+        return;
+    }
+
+    qsizetype wordStart = 0;
+    for (qsizetype i = 0; i <= run.size(); ++i) {
+        if (i < run.size() && !isHtmlSpace(run[i].unicode())) {
+            continue;
+        }
+        appendText(run.sliced(wordStart, i - wordStart));
+        if (i < run.size()) {
+            m_pendingSpace = true;
+        }
+        wordStart = i + 1;
+    }
+}
+
+void Converter::appendLineBreak()
+{
+    if (m_elided) {
+        return;
+    }
+
+    const bool blockBreak = m_pendingBreak && !m_result.isEmpty() && !m_result.endsWith(u'\n');
+    if (!fits(blockBreak ? 2 : 1)) {
+        // trailing line breaks do not need to be elided, only the text after them
+        m_pendingBreak = true;
+        return;
+    }
+
+    if (blockBreak) {
+        m_result += u'\n';
+        ++m_length;
+    }
+    m_lastStart = m_result.size();
+    m_result += u'\n';
+    m_lastEnd = m_result.size();
+    ++m_length;
+    m_pendingBreak = false;
+    m_pendingSpace = false;
+}
+
+void Converter::openTag(QLatin1StringView name, const QString &attributes)
+{
+    // the space goes before the tag, "a <b>b</b>" rather than "a<b> b</b>", unless there is no
+    // room left for it, then whatever follows is elided anyway
+    if (fits(separatorLength())) {
+        beginText();
+    }
+    m_result += u'<';
+    m_result += name;
+    m_result += attributes;
+    m_result += u'>';
+    m_openTags.append(name);
+    ++m_openCounts[name];
+}
+
+void Converter::closeTag(QLatin1StringView name)
+{
+    if (m_openCounts.value(name) == 0) {
+        return;
+    }
+
+    // whatever was opened inside is closed as well, so that the result is always well-formed;
+    // every tag looked at is closed, so this takes no longer than opening them did
+    QLatin1StringView closed;
+    do {
+        closed = m_openTags.takeLast();
+        --m_openCounts[closed];
+        m_result += QLatin1StringView("</");
+        m_result += closed;
+        m_result += u'>';
+    } while (closed != name);
+}
+
+void Converter::handleMarkupTag(const Tag &tag)
+{
+    const auto element = std::find_if(std::begin(s_markupElements), std::end(s_markupElements), [&tag](const MarkupElement &element) {
+        return tag.name.compare(element.name, Qt::CaseInsensitive) == 0;
+    });
+    if (element == std::end(s_markupElements)) {
+        return;
+    }
+
+    const QLatin1StringView name = element->canonicalName;
+    if (tag.closing) {
+        closeTag(name);
+        return;
+    }
+
+    if (name == QLatin1StringView("img")) {
+        if (m_elided) {
+            return;
+        }
+        // shows up as one character, more or less
+        if (!fits(separatorLength() + 1)) {
+            elide();
+            return;
+        }
+        QString image = QStringLiteral("<img src=\"");
+        appendEscaped(&image, attributeValue(tag.attributes, QLatin1StringView("src")));
+        image += QLatin1StringView("\" alt=\"");
+        appendEscaped(&image, attributeValue(tag.attributes, QLatin1StringView("alt")));
+        image += QLatin1StringView("\"/>");
+
+        beginText();
+        m_lastStart = m_result.size();
+        m_result += image;
+        m_lastEnd = m_result.size();
+        ++m_length;
+        return;
+    }
+
+    if (name == QLatin1StringView("a")) {
+        // links cannot be nested
+        closeTag(name);
+
+        QString attributes;
+        const QString href = attributeValue(tag.attributes, QLatin1StringView("href"));
+        if (!href.isNull()) {
+            attributes = QStringLiteral(" href=\"");
+            appendEscaped(&attributes, href);
+            attributes += u'"';
+        }
+        openTag(name, attributes);
+        return;
+    }
+
+    openTag(name);
+}
+
+void Converter::handleTag(const Tag &tag, qsizetype *pos)
+{
+    if (tag.name.compare(QLatin1StringView("br"), Qt::CaseInsensitive) == 0) {
+        appendLineBreak();
+    } else if (!tag.closing && isOneOf(tag.name, s_hiddenElements)) {
+        // skip everything up to the closing tag
+        QString closingTag = QStringLiteral("</");
+        closingTag += tag.name;
+        const qsizetype close = m_text.indexOf(closingTag, *pos, Qt::CaseInsensitive);
+        if (close < 0) {
+            *pos = m_text.size();
+        } else {
+            Tag closing;
+            parseTag(m_text, close, &closing);
+            *pos = closing.end;
+        }
+    } else if (isOneOf(tag.name, s_blockElements)) {
+        m_pendingBreak = true;
+        if (tag.name.compare(QLatin1StringView("pre"), Qt::CaseInsensitive) == 0) {
+            m_preDepth = std::max(0, m_preDepth + (tag.closing ? -1 : 1));
+        }
+    } else if (m_output == Output::Markup) {
+        handleMarkupTag(tag);
+    }
+}
+
+QString Converter::convert()
+{
+    qsizetype pos = 0;
+    qsizetype next = findMarkup(m_text, 0);
+    const qsizetype size = m_text.size();
+    while (pos < size && !m_elided) {
+        appendRun(m_text.sliced(pos, next - pos));
+        pos = next;
+        if (pos == size) {
+            break;
+        }
+
+        if (m_text[pos] == u'&') {
+            QString decoded;
+            if (const qsizetype length = decodeEntity(m_text, pos, &decoded)) {
+                // like QTextDocument::toPlainText(), which does not keep non-breaking spaces either
+                appendText(decoded == QChar(QChar::Nbsp) && m_output == Output::PlainText ? QStringLiteral(" ") : decoded);
+                pos += length;
+            } else {
+                appendText(u"&");
+                ++pos;
+            }
+        } else if (Tag tag; parseTag(m_text, pos, &tag)) {
+            pos = tag.end;
+            handleTag(tag, &pos);
+        } else {
+            appendText(u"<");
+            ++pos;
+        }
+
+        next = findMarkup(m_text, pos);
+    }
+
+    while (!m_openTags.isEmpty()) {
+        closeTag(m_openTags.constFirst());
+    }
+    return m_result;
+}
+
+QString decodeEntities(QStringView text)
+{
+    QString result;
+    result.reserve(text.size());
+
+    qsizetype pos = 0;
+    while (pos < text.size()) {
+        const qsizetype ampersand = text.indexOf(u'&', pos);
+        if (ampersand < 0) {
+            result += text.sliced(pos);
+            break;
+        }
+        result += text.sliced(pos, ampersand - pos);
+
+        QString decoded;
+        if (const qsizetype length = decodeEntity(text, ampersand, &decoded)) {
+            result += decoded;
+            pos = ampersand + length;
+        } else {
+            result += u'&';
+            pos = ampersand + 1;
+        }
+    }
+    return result;
+}
+
+QString convert(const QString &text, Output output, qsizetype maxLength)
+{
+    if (!mightContainMarkup(text)) {
+        // not HTML, so nothing to collapse or escape either
+        return elidedText(text, maxLength);
+    }
+
+    const ConversionKey key{text, output, maxLength};
+    QString result;
+    if (s_conversionCache->find(key, &result)) {
+        return result;
+    }
+
+    result = Converter(text, output, maxLength).convert();
+    s_conversionCache->insert(key, result);
+    return result;
+}
+
+} // namespace
+
+qsizetype decodeEntity(QStringView text, qsizetype pos, QString *decoded)
+{
+    // the longest entity is a numeric one, like &#x10ffff; or &#1114111;
+    constexpr qsizetype maxLength = 10;
+
+    const qsizetype semicolon = text.sliced(pos, std::min(maxLength + 1, text.size() - pos)).indexOf(u';');
+    if (semicolon < 2) {
+        return 0;
+    }
+    const QStringView name = text.sliced(pos + 1, semicolon - 1);
+
+    if (name.startsWith(u'#')) {
+        bool ok = false;
+        const bool hex = name.size() > 1 && (name[1] == u'x' || name[1] == u'X');
+        const uint codePoint = hex ? name.sliced(2).toUInt(&ok, 16) : name.sliced(1).toUInt(&ok, 10);
+        if (!ok || codePoint == 0 || codePoint > QChar::LastValidCodePoint || QChar::isSurrogate(codePoint)) {
+            return 0;
+        }
+        const char32_t ucs4 = codePoint;
+        *decoded = QString::fromUcs4(&ucs4, 1);
+        return semicolon + 1;
+    }
+
+    const auto it = std::lower_bound(std::begin(s_entities), std::end(s_entities), name, [](const NamedEntity &entity, QStringView name) {
+        return entity.name.compare(name) < 0;
+    });
+    if (it == std::end(s_entities) || it->name != name) {
+        return 0;
+    }
+    *decoded = QChar(it->value);
+    return semicolon + 1;
+}
+
+QString toPlainText(const QString &text, qsizetype maxLength)
+{
+    return convert(text, Output::PlainText, maxLength);
+}
+
+QString normalizedMarkup(const QString &text, qsizetype maxLength)
+{
+    return convert(text, Output::Markup, maxLength);
+}
+
+QString elided(const QString &text, qsizetype maxLength)
+{
+    return elidedText(text, maxLength);
+}
+
+} // namespace
@@ -0,0 +1,68 @@
+/*
+    SPDX-FileCopyrightText: 2026 KDE Contributors
+
+    SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+*/
+
+#ifndef RICHTEXT_H
+#define RICHTEXT_H
+
+#include "knotifications_export.h"
+
+#include <QString>
+
+/*
+ * Handling of the HTML subset notification texts may contain
+ */
+namespace RichText
+{
+/*
+ * Whether text contains a '<' or '&', i.e. may be anything but plain text
+ */
+KNOTIFICATIONS_TESTS_EXPORT bool mightContainMarkup(QStringView text);
+
+/*
+ * Converts the HTML text to plain text in a single pass, like QTextDocument would:
+ * tags are removed, entities are decoded, whitespace is collapsed except in <pre>,
+ * and block elements and <br> end up as line breaks.
+ *
+ * If maxLength is greater than 0, the result is elided like elided() does.
+ *
+ * Text without any markup is returned untouched. Results are cached, as applications
+ * tend to send the same texts over and over again.
+ */
+KNOTIFICATIONS_TESTS_EXPORT QString toPlainText(const QString &text, qsizetype maxLength = 0);
+
+/*
+ * Rewrites the HTML text into the markup subset of the notification spec, i.e.
+ * only b, i, u, a with href and img with src and alt, in a single pass.
+ *
+ * Everything else is converted like toPlainText() does, the result is always
+ * well-formed. If maxLength is greater than 0, the result is elided after that
+ * many visible characters, with the open tags closed.
+ */
+KNOTIFICATIONS_TESTS_EXPORT QString normalizedMarkup(const QString &text, qsizetype maxLength = 0);
+
+/*
+ * Returns text cut down to at most maxLength characters if it is longer, ending in "…"
+ *
+ * It is cut at a grapheme boundary, so that no surrogate pairs or combining
+ * characters are torn apart. A maxLength of 0 means there is no limit.
+ */
+KNOTIFICATIONS_TESTS_EXPORT QString elided(const QString &text, qsizetype maxLength);
+
+/*
+ * Decodes the entity at text[pos], which is a '&', into *decoded
+ *
+ * Returns the length of the entity including the '&' and ';', or 0 if it is not a valid one.
+ */
+qsizetype decodeEntity(QStringView text, qsizetype pos, QString *decoded);
+
+/*
+ * Returns the position of the next '<' or '&' in text at or after from, or text.size()
+ */
+qsizetype findMarkup(QStringView text, qsizetype from);
+
+} // namespace
+
+#endif